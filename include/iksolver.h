@@ -1,10 +1,11 @@
 /* TODO */
-/* Implement constraints */
 /* Description */
 
 #ifndef IKSOLVER_H
 #define IKSOLVER_H
 
+#include <stddef.h>
+
 #define IK_ERROR 0
 #define IK_OK    1
 
@@ -19,21 +20,92 @@ typedef struct { float x, y; } ik_vec2;
 
 
 
+/*
+ * Rigid transform mapping p to R p + t, where R rotates by an 
+ *  angle with cosine 'c' and sine 's'.
+ */
+typedef struct { float c, s, tx, ty; } ik_transform;
+
+
+
+/*
+ * Reference to joint in a joint pool, combining slot index and
+ *  generation of the slot, so that references to deleted joints can
+ *  be detected. Zero is never a valid handle.
+ */
+typedef unsigned int ik_handle;
+
+#define IK_HANDLE_INDEX_BITS 20
+#define IK_HANDLE_INDEX_MASK ((1u << IK_HANDLE_INDEX_BITS) - 1)
+#define IK_HANDLE_MAX_GENERATION ((1u << (32 - IK_HANDLE_INDEX_BITS)) - 1)
+
+
+
+#ifdef IK_ALLOCATOR
+
+/*
+ * Allocator used instead of IK_MALLOC and IK_FREE while set with
+ *  ik_set_allocator. 'free' receives the size passed to 'alloc', and
+ *  'user' is passed to both. Blocks must be aligned to 16 bytes.
+ */
+typedef struct {
+    void *(*alloc)(void *user, size_t size);
+    void (*free)(void *user, void *ptr, size_t size);
+    void *user;
+} ik_allocator;
+
+#endif
+
+
+
+/*
+ * Memory orders for ik_relayout.
+ *  IK_LAYOUT_DFS places every branch contiguously, continuing each 
+ *   path through the child with the largest branch first.
+ *  IK_LAYOUT_VEB uses a van Emde Boas layout, which keeps joints close
+ *   to their ancestors at every scale, for very large trees.
+ */
+#define IK_LAYOUT_DFS 0
+#define IK_LAYOUT_VEB 1
+
+
+
 /*
  * Struct defining joint, including length of segment 
  *  connecting this joint to it's parent. 
- * Attaching less than 'n_children' before any operation 
- *  on the tree is undefined behavior.
+ * 'children' holds 'n_children' attached children, and points to
+ *  'inline_children' until it grows past the capacity given to
+ *  ik_new_joint.
  */
 typedef struct ik_joint {
 
     ik_vec2 position;
     float length;
 
+    /* Angle limits, see ik_set_constraint */
+    float min_angle, max_angle;
+    int constrained;
+
+    /* Transform not yet applied to branch, see ik_set_deferred_alignment */
+    ik_transform pending;
+    int has_pending;
+
+    /* Number of joints in branch beginning at this joint, or 0 if it
+     *  changed since last counted, see ik_subtree_size */
+    int subtree_size;
+
+    /* Handle of joint if owned by a joint pool, otherwise 0 */
+    ik_handle handle;
+
+    /* Allocation shared with other joints, see ik_relayout */
+    struct ik_joint_block *block;
+
     int n_children;
+    int children_cap;
 
     struct ik_joint *parent;
-    struct ik_joint *children[0];
+    struct ik_joint **children;
+    struct ik_joint *inline_children[0];
 
 } ik_joint;
 
@@ -51,650 +123,5139 @@ typedef struct {
 
 
 
-/**********************************************
- *                 FUNCTIONS                  *
- **********************************************/
+/*
+ * Fixed capacity vertex buffer shared by threads writing render data
+ *  of different trees or poses. Each writer reserves a contiguous range
+ *  by atomically advancing 'size', and fills it without locking, so
+ *  that all segments can be drawn with a single call.
+ */
+typedef struct {
+    ik_vec2 *data;
+    int size;
+    int cap;
+} ik_render_pool;
 
-#ifdef __cplusplus
-extern "C" {
-#endif
 
 
 /*
- * Sets up global state required for other functions
+ * Owns joints referenced through handles. The pool may relocate 
+ *  joints, so pointers from ik_pool_get should not be kept across 
+ *  calls that modify the pool.
  */
-void ik_init(void);
+typedef struct {
+    ik_joint **joints;          /* NULL for free slots */
+    unsigned int *generation;
+    int *next_free;
+    int free_head;              /* -1 if there are no free slots */
+    int size;
+    int cap;
+} ik_joint_pool;
 
 
 
 /*
- * Creates a new joint with capacity to hold 'n_children'
- *  attached children.
+ * Precomputed path from an effected joint to the tree root, letting
+ *  the joint be solved repeatedly without walking parent pointers or 
+ *  using the path stack. Must be recreated when topology of the tree
+ *  changes.
  */
-ik_joint *ik_new_joint(float length, int n_children);
+typedef struct {
+    int n_path;
+    ik_joint **path;    /* path[0] is effected joint, path[n_path - 1] is root */
+} ik_effector;
 
 
 
-/* 
- * Deletes branch beginning at root
+/*
+ * Solvers selectable for ik_solve_iterative.
+ *  IK_SOLVER_FABRIK repeats the back and forward reach of ik_solve.
+ *  IK_SOLVER_CCD rotates the branch below each joint of the path in
+ *   turn, from the effected joint up to the root, so that the effected
+ *   joint points at the target.
+ *  IK_SOLVER_DLS rotates all joints of the path at once by damped least
+ *   squares steps, giving smooth and stable motion near singular poses,
+ *   such as an almost stretched chain. Like any Jacobian method, it 
+ *   can't bend an exactly straight chain towards a target on its line.
  */
-void ik_delete_branch(ik_joint *root);
+#define IK_SOLVER_FABRIK 0
+#define IK_SOLVER_CCD    1
+#define IK_SOLVER_DLS    2
 
 
 
 /*
- * Attaches 'child' to 'parent'. 
- * Returns IK_ERROR if maximum children is
- *  reached for 'parent'.
+ * Initial guesses placed along the path by ik_solve_iterative before
+ *  iterating, ignoring angle constraints.
+ *  IK_SEED_PREVIOUS starts from the current pose, usually the solution
+ *   of the previous frame.
+ *  IK_SEED_STRAIGHT stretches the path from the root towards the target
+ *   if it is out of reach, and otherwise keeps the current pose, as
+ *   solvers can't bend a straight path towards a target on its line.
+ *  IK_SEED_TWO_BONE splits the path in two halves of about equal length,
+ *   bends it at the joint between them to reach the target exactly if
+ *   possible, and keeps each half straight. The bend keeps the side of
+ *   the current pose.
  */
-int ik_attach_joint(ik_joint *child, ik_joint *parent);
+#define IK_SEED_PREVIOUS 0
+#define IK_SEED_STRAIGHT 1
+#define IK_SEED_TWO_BONE 2
 
 
 
 /*
- * Translates tree by setting root position to (x, y)
+ * Histograms of iterative solves sharing a sink, see ik_solve_params.
+ *  Residual bucket 0 counts residuals below 1e-7, bucket i counts
+ *   [10^(i-8), 10^(i-7)), and the last bucket everything from 1e7.
+ *  Iteration bucket i counts solves taking i passes, and the last
+ *   bucket solves taking IK_TELEMETRY_BUCKETS - 1 or more.
+ *  Time bucket 0 counts solves under 256 ns, bucket i counts
+ *   [2^(i+7), 2^(i+8)) ns, and the last bucket everything from 2^22 ns.
+ * Updating is not atomic, so a sink must only be used by one thread
+ *  at a time.
  */
-void ik_translate(ik_joint *root, float x, float y);
+#define IK_TELEMETRY_BUCKETS 16
+
+typedef struct {
+    long long n_solves;
+    long long n_converged;
+    long long total_iterations;
+    long long total_ns;
+    long long max_ns;
+    float max_residual;
+
+    long long residual[IK_TELEMETRY_BUCKETS];
+    long long iterations[IK_TELEMETRY_BUCKETS];
+    long long time_ns[IK_TELEMETRY_BUCKETS];
+} ik_telemetry;
 
 
 
 /*
- * Solves IK using FABRIK model.
+ * Parameters of ik_solve_iterative. Every solver stops after
+ *  'max_iterations' passes over the path, or earlier once the effected
+ *  joint is within 'tolerance' of the target. After seeding other than
+ *  IK_SEED_PREVIOUS, at least one pass is made to apply constraints,
+ *  unless 'max_iterations' is 0 or less.
  */
-int ik_solve(ik_joint *effected, float target_x, float target_y);
+typedef struct {
+    int solver;
+    int seed;
+    int max_iterations;
+    float tolerance;
+    float damping;      /* IK_SOLVER_DLS only, larger is smoother but slower */
+    ik_telemetry *telemetry;    /* sink for outcome of every solve, or NULL */
+} ik_solve_params;
 
 
 
 /*
- * Retrieves vertex positions for rendering tree.
+ * Outcome of ik_solve_iterative.
  */
-void ik_get_render_data(ik_joint *root, ik_vertex_buffer *buffer);
+typedef struct {
+    int iterations;     /* passes performed */
+    float residual;     /* final distance from effected joint to target */
+} ik_solve_result;
 
 
 
 /*
- * Creates a new vertex buffer.
+ * Timing results of ik_replay.
  */
-ik_vertex_buffer ik_new_vertex_buffer(void);
+typedef struct {
+    int n_solves;
+    int n_translates;
+    long long total_ns;     /* total time spent in replayed calls */
+    long long max_solve_ns; /* slowest single solve */
+} ik_replay_stats;
 
 
 
 /*
- * Frees buffer data, setting buffer to invalid state.
+ * Immutable topology of a joint tree, shared between any number of 
+ *  poses. Joints are indexed in the order written by ik_get_pose, so
+ *  every joint comes after it's parent, and the branch beginning at 
+ *  joint i occupies indices [i, i + subtree_size[i]).
  */
-void ik_free_vertex_buffer(ik_vertex_buffer *buffer);
+typedef struct {
+    int n_joints;
 
+    int *parent;            /* -1 for root */
+    int *n_children;
+    int *first_child;       /* index of first child in 'children' */
+    int *children;
+    int *subtree_size;
 
+    float *length;
+    float *min_angle;
+    float *max_angle;
+    int *constrained;
+} ik_skeleton;
 
-#ifdef __cplusplus
-}
-#endif
 
-#endif /* IKSOLVER_H */
 
+/*
+ * Criteria for removing joints when building a reduced skeleton with
+ *  ik_new_skeleton_lod.
+ */
+typedef struct {
+    float max_bend;             /* merge runs of joints bending less than this in total, radians */
+    float min_length;           /* merge runs of joints spanning less than this */
+    float min_branch_length;    /* drop side branches reaching less far than this */
+} ik_lod_params;
 
-#ifdef IKSOLVER_IMPLEMENTATION
 
-/**********************************************
- *                 UTILITY                    *
- **********************************************/
 
-#ifndef IK_MALLOC
-# include <stdlib.h>
-# define IK_MALLOC malloc
-# define IK_FREE   free
-#endif
+/*
+ * Reduced skeleton, with mapping back to the full resolution skeleton
+ *  the tree would give to ik_new_skeleton. Full joint i is kept as
+ *  joint lod_index[i] of 'skeleton', or otherwise placed relative to
+ *  other full joints as
+ *   full[base[i]] + coord[i].x * d + coord[i].y * perp(d),
+ *  where d = full[to[i]] - full[from[i]] and perp(d) is d turned by 90
+ *  degrees, or d = (1, 0) if from[i] is -1.
+ */
+typedef struct {
+    ik_skeleton *skeleton;
+    int n_full;
+    int *lod_index;
+    int *base;
+    int *from;
+    int *to;
+    ik_vec2 *coord;
+} ik_skeleton_lod;
 
-#ifndef IK_SQRT
-# include <math.h>
-# define IK_SQRT sqrtf
-#endif
 
-#ifndef IK_MEMCPY
-# include <string.h>
-# define IK_MEMCPY memcpy
-#endif
 
-#ifndef NULL
-# define NULL ((void*)0)
-#endif
+/*
+ * Triple buffer of poses, letting one thread publish poses while
+ *  another thread reads the most recently published pose, without
+ *  locking. A pose is an array of joint positions in the order 
+ *  written by ik_get_pose.
+ * 'back' is owned by the writer, 'front' by the reader, and 'middle'
+ *  is swapped atomically between them.
+ */
+typedef struct {
+    ik_vec2 *data;
+    int n_joints;
+    int back;
+    int middle;
+    int front;
+} ik_pose_buffer;
 
-#ifdef IK_DEBUG
-# include <stdio.h>
-# define LOG(msg, ...) printf(msg "\n", __VA_ARGS__)
-# define INDENT() indent++
-# define UNINDENT() indent--
-static int indent = 0;
-#else
-# define LOG(msg, ...)
-# define INDENT()
-# define UNINDENT()
-#endif
 
 
 /**********************************************
- *             INTERNAL FUNCTIONS             *
+ *                 FUNCTIONS                  *
  **********************************************/
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 /*
- * Calculates length of vector (x, y)
+ * Sets up global state required for other functions
  */
-static inline float length(float x, float y)
-{
-    return IK_SQRT(x * x + y * y);
-}
+void ik_init(void);
+
 
 
+/*
+ * Frees scratch memory kept by the calling thread for solving. It is
+ *  allocated again on the next solve, so this is only needed before a
+ *  thread that solved exits, or to release memory after solving very
+ *  deep trees. Must not be called during a solve.
+ */
+void ik_free_scratch(void);
 
 
 
+#ifdef IK_ALLOCATOR
+
 /*
- * Stack for pushing ik_joint pointers to during back reach, so that 
- *  we know which path to take when reaching forward. 
+ * Sets allocator for all memory allocated by the calling thread, or
+ *  restores IK_MALLOC and IK_FREE if 'allocator' is NULL or its 'alloc'
+ *  is NULL. Returns the previous allocator, with 'alloc' NULL for the
+ *  default. Memory is returned to the allocator it came from, from any
+ *  thread, so 'user' must stay valid until all of it is freed. Scratch
+ *  memory is included, see ik_free_scratch.
  */
+ik_allocator ik_set_allocator(const ik_allocator *allocator);
 
-#define IK_STACK_SIZE 1024 /* TODO: allow user to define this (?) */
-typedef ik_joint **ik_stack_ptr;
-struct {
-    ik_stack_ptr end;
-    ik_joint *data[IK_STACK_SIZE];
-} ik_stack;
+#endif
 
-static inline void ik_stack_push(ik_joint *joint)
-{
-    /* TODO: bounds-checking (?) */
-    LOG("Pushing joint %p", joint);
-    *(ik_stack.end++) = joint;
-}
 
-static inline ik_joint *ik_stack_pop(void)
-{
-    if(ik_stack.end == ik_stack.data)
-        return NULL;
 
-    ik_joint *joint = *(--ik_stack.end); 
-    LOG("Popping joint %p", joint);
-    return joint;
-}
+/*
+ * Creates a new joint with capacity to hold 'n_children'
+ *  attached children.
+ */
+ik_joint *ik_new_joint(float length, int n_children);
 
-static inline ik_joint *ik_stack_top(void)
-{
-    if(ik_stack.end == ik_stack.data)
-        return NULL;
 
-    return *(ik_stack.end - 1);
-}
+
+/* 
+ * Deletes branch beginning at root
+ */
+void ik_delete_branch(ik_joint *root);
 
 
 
 /*
- * Struct to represent entries of rotation matrix.
- *
- *  C: cos(abs(angle))
- *  S: sin(abs(angle))
- *  P: sgn(angle)
- *
+ * Attaches 'child' to 'parent'. Takes constant time, apart from 
+ *  applying transforms pending above 'parent' with deferred alignment.
+ * Returns IK_ERROR if maximum children is
+ *  reached for 'parent'.
  */
-struct ik_matrix { float C, S, P; };
+int ik_attach_joint(ik_joint *child, ik_joint *parent);
 
 
 
-/* 
- * Aligns branch according to precalculated values.
- *
- *  root: root joint of branch to be aligned
- *  pivot: position to rotate around
- *  mat: entries of rotation matrix
- *  offset: offset to translate
- * 
+/*
+ * Attaches 'child' to 'parent', growing capacity of 'parent'
+ *  if needed.
  */
-static void ik_align_branch_precalc(ik_joint *root, ik_vec2 pivot, struct ik_matrix mat, ik_vec2 offset)
-{
-    LOG("Aligning branch %p", root);
+void ik_append_joint(ik_joint *child, ik_joint *parent);
 
-    /* Translate */
-    root->position.x += offset.x;
-    root->position.y += offset.y;
 
-    /* Rotate */
-    root->position.x -= pivot.x;
-    root->position.y -= pivot.y;
 
-    float tmp_x = root->position.x;
+/*
+ * Detaches 'child' from it's parent, making it the root of
+ *  a separate tree. Positions are left unchanged.
+ */
+void ik_detach_joint(ik_joint *child);
 
-    /* P is applied using identies cos(-a) = cos(a), sin(-a) = -sin(a) */
-    root->position.x = (mat.C        ) * root->position.x + (-mat.P * mat.S) * root->position.y;
-    root->position.y = (mat.P * mat.S) * tmp_x            + ( mat.C        ) * root->position.y;
 
-    root->position.x += pivot.x;
-    root->position.y += pivot.y;
 
-    /* Recurse */
-    /* TODO: Use stack instead of recursion? */
-    for(int i = 0; i < root->n_children; i++)
-        ik_align_branch_precalc(root->children[i], pivot, mat, offset);
-}
+/*
+ * Moves 'child' with it's branch from it's current parent to 
+ *  'parent'. Positions are left unchanged.
+ * Returns IK_ERROR if 'parent' is part of branch of 'child'.
+ */
+int ik_reparent_joint(ik_joint *child, ik_joint *parent);
 
 
 
-/* 
- * This function is used for translating/rotating branches that are not
- *  affected by back or forward reach.
- * 
- *  root: root joint of branch to be aligned
- *  from: previous position of root's parent, relative to it's parent
- *  to: new position of root's parent, relative to it's parent
- * 
+/*
+ * Moves all joints of branch beginning at 'root' into a single 
+ *  allocation, ordered by 'layout', and returns the new location of 
+ *  'root'. Topology, positions and constraints are kept, and the branch
+ *  stays attached to the parent of 'root'. Pointers to joints of the
+ *  branch, including effectors, are invalidated.
+ *  Joints owned by a joint pool must use ik_pool_relayout instead.
  */
-static void ik_align_branch(ik_joint *root, ik_vec2 from, ik_vec2 to)
-{
-    /* Find rotation matrix entries */
-    struct ik_matrix mat;
+ik_joint *ik_relayout(ik_joint *root, int layout);
 
-    /* C = cos(angle) */
-    float C_denom = length(from.x, from.y) * length(to.x, to.y);
-    mat.C = (from.x * to.x + from.y * to.y) / C_denom;
-    
-    /* S = sin(angle) */
-    float S2 = 1 - mat.C * mat.C;
-    mat.S = IK_SQRT(S2 > 0.0f ? S2 : 0.0f);
 
-    /* P = sgn(angle) */
-    mat.P = from.x * to.y - from.y * to.x > 0.0f ? 1.0f : -1.0f;
 
+/*
+ * Limits angle between segment connecting 'joint' to it's parent
+ *  and the parent's own segment to [min_angle, max_angle] radians,
+ *  counter-clockwise positive. Has no effect on joints whose parent
+ *  is the tree root.
+ * Returns IK_ERROR if 'min_angle' is greater than 'max_angle'.
+ */
+int ik_set_constraint(ik_joint *joint, float min_angle, float max_angle);
 
-    /* Find offset */
-    ik_vec2 offset;
-    offset.x = to.x - from.x;
-    offset.y = to.y - from.y;
 
-    /* Use parents position as pivot, as rotation takes place after translation */
-    LOG("Aligning branch %p, C = %f, S = %f, P = %f, offset = (%f, %f)",
-            root, mat.C, mat.S, mat.P, offset.x, offset.y);
-    ik_align_branch_precalc(root, root->parent->position, mat, offset);
-}
+
+/*
+ * Removes angle limits from joint.
+ */
+void ik_clear_constraint(ik_joint *joint);
 
 
 
 /*
- * Translates branch by offset.
- * Used to align branch who's parent is the tree root.
+ * Creates a new joint pool.
  */
-static void ik_align_branch_only_translate(ik_joint *root, float offset_x, float offset_y)
-{
-    LOG("Translating branch %p", root);
-    root->position.x += offset_x;
-    root->position.y += offset_y;
-
-    for(int i = 0; i < root->n_children; i++)
-        ik_align_branch_only_translate(root->children[i], offset_x, offset_y);
-}
+ik_joint_pool ik_new_joint_pool(void);
 
 
 
 /*
- * Moves joint within distance of target.
+ * Deletes all joints of pool and frees pool data, setting pool to
+ *  invalid state.
  */
-static inline void ik_move_within_dist(ik_joint *joint, float distance, float target_x, float target_y)
-{
-    LOG("Moving joint %p within distance %f of (%f, %f)", joint, distance, target_x, target_y);
-    float dx = joint->position.x - target_x;
-    float dy = joint->position.y - target_y;
-    float norm_denom = length(dx, dy);
+void ik_free_joint_pool(ik_joint_pool *pool);
 
-    if(norm_denom == 0.0f)
-    {
-        joint->position.x = target_x;
-        joint->position.y = target_y;
-    } else {
-        joint->position.x = target_x + distance * dx / norm_denom;
-        joint->position.y = target_y + distance * dy / norm_denom;
-    }
-}
+
+
+/*
+ * Creates a new joint owned by pool, like ik_new_joint.
+ *  Returns 0 if pool is full.
+ */
+ik_handle ik_pool_new_joint(ik_joint_pool *pool, float length, int n_children);
 
 
 
 /*
- * This functions iterates backwards, and must be followed immediatly
- *  by ik_reach_forward, as joint pointers are push to the stack.
- * Distance must be zero when function is called from outside itself.
- * 
- * Since this function traverses tree to the root, the three last arguments provide
- *  access to the root joint, and its original position, which is used for forward reach.
- * 
+ * Returns joint referenced by handle, or NULL if handle
+ *  is not valid.
  */
-static void ik_reach_back(ik_joint *effected, float target_x, float target_y, float distance,
+ik_joint *ik_pool_get(const ik_joint_pool *pool, ik_handle handle);
+
+
+
+/*
+ * Returns non-zero if handle references an existing joint.
+ */
+int ik_pool_valid(const ik_joint_pool *pool, ik_handle handle);
+
+
+
+/*
+ * Attaches joints of pool, like ik_attach_joint.
+ *  Returns IK_ERROR if either handle is invalid.
+ */
+int ik_pool_attach(ik_joint_pool *pool, ik_handle child, ik_handle parent);
+
+
+
+/*
+ * Deletes branch beginning at joint referenced by handle, removing it
+ *  from it's parent, and invalidates handles of all deleted joints.
+ *  All joints of the branch must be owned by pool.
+ */
+void ik_pool_delete_branch(ik_joint_pool *pool, ik_handle root);
+
+
+
+/*
+ * Relocates branch beginning at joint referenced by handle like 
+ *  ik_relayout, keeping handles of it's joints valid. All joints of 
+ *  the branch must be owned by pool.
+ *  Returns IK_ERROR if handle is invalid.
+ */
+int ik_pool_relayout(ik_joint_pool *pool, ik_handle root, int layout);
+
+
+
+/*
+ * Enables or disables deferred alignment. When enabled, branches that
+ *  need to follow a moved joint during solving are not transformed 
+ *  immediately. Instead a pending transform is stored at the branch 
+ *  root and combined with any later ones, and the branch is transformed
+ *  once it is read or solved through. Disabled by default.
+ * The setting and the record of pending transforms belong to the
+ *  calling thread, so threads solving separate trees don't share state.
+ *  A tree left with pending transforms must be flushed by the thread
+ *  that solved it before another thread uses it.
+ */
+void ik_set_deferred_alignment(int enabled);
+
+
+
+/*
+ * Applies pending transforms of branch beginning at 'root' and of its 
+ *  ancestors. Functions reading positions of a tree do this implicitly,
+ *  but reading 'position' members directly requires calling this first.
+ */
+void ik_flush_transforms(ik_joint *root);
+
+
+
+#ifdef IK_PARALLEL
+
+/*
+ * Starts 'n_threads' worker threads aligning side branches with at 
+ *  least 'min_branch_size' joints in parallel during solving. Large
+ *  branches are split further as they are aligned, and idle threads 
+ *  steal work from busy ones. Only one thread may solve at a time 
+ *  while workers are running.
+ * Returns IK_ERROR if threads can't be started.
+ */
+int ik_start_parallel_alignment(int n_threads, int min_branch_size);
+
+
+
+/*
+ * Stops worker threads started by ik_start_parallel_alignment.
+ */
+void ik_stop_parallel_alignment(void);
+
+#endif
+
+
+
+/*
+ * Translates tree by setting root position to (x, y)
+ */
+void ik_translate(ik_joint *root, float x, float y);
+
+
+
+/*
+ * Solves IK using FABRIK model.
+ */
+int ik_solve(ik_joint *effected, float target_x, float target_y);
+
+
+
+/*
+ * Solves IK like ik_solve, filling 'buffer' with the same segments as 
+ *  ik_get_render_data during the final pass, without traversing the 
+ *  tree again. Segment order may differ from ik_get_render_data.
+ *  'buffer' may be NULL.
+ */
+int ik_solve_render(ik_joint *effected, float target_x, float target_y, ik_vertex_buffer *buffer);
+
+
+
+/*
+ * Creates effector handle for solving 'effected'.
+ */
+ik_effector *ik_new_effector(ik_joint *effected);
+
+
+
+/*
+ * Deletes effector handle. Joints are not affected.
+ */
+void ik_delete_effector(ik_effector *effector);
+
+
+
+/*
+ * Solves IK with a single pass of FABRIK along precomputed path of
+ *  'effector'. Children of the effected joint follow it rigidly.
+ */
+int ik_solve_effector(ik_effector *effector, float target_x, float target_y);
+
+
+
+/*
+ * Returns parameters solving with FABRIK from the current pose for up
+ *  to 10 iterations, with tolerance of 0.001 and damping of 0.1,
+ *  without telemetry.
+ */
+ik_solve_params ik_default_solve_params(void);
+
+
+
+/*
+ * Solves IK by iterating solver selected by 'params' until it
+ *  converges. The root is not moved, and children of 'effected' follow
+ *  it rigidly. 'result' may be NULL.
+ * Returns IK_ERROR if the target is not reached within tolerance.
+ */
+int ik_solve_iterative(ik_joint *effected, float target_x, float target_y,
+                       const ik_solve_params *params, ik_solve_result *result);
+
+
+
+/*
+ * Solves IK like ik_solve_iterative, using precomputed path of 'effector'.
+ */
+int ik_solve_effector_iterative(ik_effector *effector, float target_x, float target_y,
+                                const ik_solve_params *params, ik_solve_result *result);
+
+
+
+/*
+ * Clears all counts of telemetry sink.
+ */
+void ik_reset_telemetry(ik_telemetry *telemetry);
+
+
+
+/*
+ * Restores exact segment lengths in branch beginning at 'root',
+ *  keeping segment directions. Root position is left unchanged.
+ */
+void ik_renormalize(ik_joint *root);
+
+
+
+/*
+ * Returns largest difference between actual segment length and
+ *  'length' member among joints in branch beginning at 'root'.
+ */
+float ik_max_length_error(ik_joint *root);
+
+
+
+/*
+ * Retrieves vertex positions for rendering tree.
+ */
+void ik_get_render_data(ik_joint *root, ik_vertex_buffer *buffer);
+
+
+
+/*
+ * Writes the same vertices as ik_get_render_data to a range reserved
+ *  in 'pool', and returns index of the first, or -1 if pool is full.
+ *  May be called from several threads for different trees. Pending
+ *  transforms are not applied, so with deferred alignment
+ *  ik_flush_transforms must be called first.
+ */
+int ik_render_to_pool(ik_joint *root, ik_render_pool *pool);
+
+
+
+/*
+ * Returns number of joints in branch beginning at 'root'.
+ */
+int ik_count_joints(ik_joint *root);
+
+
+
+/*
+ * Writes joint positions of branch beginning at 'root' to 'pose',
+ *  in depth first order. 'pose' must hold ik_count_joints(root) entries.
+ */
+void ik_get_pose(ik_joint *root, ik_vec2 *pose);
+
+
+
+/*
+ * Sets joint positions of branch beginning at 'root' from 'pose',
+ *  in the order written by ik_get_pose.
+ */
+void ik_set_pose(ik_joint *root, const ik_vec2 *pose);
+
+
+
+/*
+ * Returns index of 'joint' in the order written by ik_get_pose,
+ *  or -1 if it is not part of branch beginning at 'root'.
+ */
+int ik_joint_index(ik_joint *root, ik_joint *joint);
+
+
+
+/*
+ * Creates a skeleton from topology, lengths and constraints of
+ *  tree beginning at 'root'. The tree is not referenced afterwards.
+ */
+ik_skeleton *ik_new_skeleton(ik_joint *root);
+
+
+
+/*
+ * Deletes skeleton.
+ */
+void ik_delete_skeleton(ik_skeleton *skeleton);
+
+
+
+/*
+ * Creates reduced skeleton of tree beginning at 'root', using current
+ *  positions as reference pose. Joints with a single remaining child
+ *  are merged into one segment between the nearest kept joints while
+ *  the bends of the merged joints add up to less than 'max_bend', or
+ *  their segments add up to less than 'min_length', so the merged
+ *  segment stays close to the joints it replaces. A branch hanging off
+ *  a joint with several children is dropped if it reaches less than
+ *  'min_branch_length' from there, unless it holds a kept joint.
+ *  Removed joints follow the kept ones by interpolation. The root,
+ *  the 'n_keep' joints listed in 'keep' (full indices in the order of
+ *  ik_get_pose), constrained joints and their parents are always kept.
+ */
+ik_skeleton_lod *ik_new_skeleton_lod(ik_joint *root, const ik_lod_params *params,
+                                     const int *keep, int n_keep);
+
+
+
+/*
+ * Deletes reduced skeleton.
+ */
+void ik_delete_skeleton_lod(ik_skeleton_lod *lod);
+
+
+
+/*
+ * Writes positions of kept joints of 'full_pose' to 'lod_pose', to
+ *  continue solving a full resolution pose at reduced detail.
+ */
+void ik_lod_reduce_pose(const ik_skeleton_lod *lod, const ik_vec2 *full_pose, ik_vec2 *lod_pose);
+
+
+
+/*
+ * Reconstructs full resolution pose from pose of reduced skeleton.
+ */
+void ik_lod_expand_pose(const ik_skeleton_lod *lod, const ik_vec2 *lod_pose, ik_vec2 *full_pose);
+
+
+
+/*
+ * Solves IK using FABRIK model, operating on 'pose' with topology 
+ *  given by 'skeleton'. Children of joint 'effected' follow it rigidly.
+ * Returns IK_ERROR if 'effected' is not a valid index.
+ */
+int ik_skeleton_solve(const ik_skeleton *skeleton, ik_vec2 *pose, int effected, 
+                      float target_x, float target_y);
+
+
+
+/*
+ * Callback receiving solved poses from ik_skeleton_solve_trajectory_stream.
+ *  'pose' is only valid during the call.
+ */
+typedef void (*ik_pose_callback)(void *user, int step, const ik_vec2 *pose, int n_joints);
+
+
+
+/*
+ * Solves joint 'effected' towards each of 'n_targets' targets in turn,
+ *  starting each step from the previous result. 'pose' holds the start
+ *  pose and is left at the last result. Solved poses are written 
+ *  consecutively to 'poses', which may be NULL.
+ * Returns IK_ERROR if 'effected' is not a valid index.
+ */
+int ik_skeleton_solve_trajectory(const ik_skeleton *skeleton, ik_vec2 *pose, int effected,
+                                 const ik_vec2 *targets, int n_targets, ik_vec2 *poses);
+
+
+
+/*
+ * Like ik_skeleton_solve_trajectory, but passes each solved pose to 
+ *  'callback' instead of storing it, e.g. to stream results to disk.
+ */
+int ik_skeleton_solve_trajectory_stream(const ik_skeleton *skeleton, ik_vec2 *pose, int effected,
+                                        const ik_vec2 *targets, int n_targets,
+                                        ik_pose_callback callback, void *user);
+
+
+
+/*
+ * Single solve of a batch, see ik_solve_batch.
+ */
+typedef struct {
+    const ik_skeleton *skeleton;
+    ik_vec2 *pose;
+    int effected;
+    float target_x;
+    float target_y;
+    int status;         /* result of ik_skeleton_solve, set by ik_solve_batch */
+} ik_solve_job;
+
+
+
+/*
+ * Reorders 'n_jobs' jobs by address of their skeleton, and jobs sharing
+ *  a skeleton by Morton code of their target within the bounds of all
+ *  targets, so that consecutive solves reuse topology and nearby field
+ *  samples in cache. Jobs are moved rather than indexed, so that they
+ *  are read in order when solving. Uses radix sort, so the cost is
+ *  linear in 'n_jobs'.
+ */
+void ik_sort_solve_jobs(ik_solve_job *jobs, int n_jobs);
+
+
+
+/*
+ * Sorts jobs with ik_sort_solve_jobs and solves them like
+ *  ik_skeleton_solve, setting 'status' of each. Jobs must not share
+ *  a pose.
+ * Returns IK_ERROR if any job failed.
+ */
+int ik_solve_batch(ik_solve_job *jobs, int n_jobs);
+
+
+
+/*
+ * Translates pose by setting root position to (x, y)
+ */
+void ik_skeleton_translate(const ik_skeleton *skeleton, ik_vec2 *pose, float x, float y);
+
+
+
+/*
+ * Restores exact segment lengths of pose, keeping segment directions.
+ */
+void ik_skeleton_renormalize(const ik_skeleton *skeleton, ik_vec2 *pose);
+
+
+
+/*
+ * Returns largest difference between actual and defined segment
+ *  length in pose.
+ */
+float ik_skeleton_max_length_error(const ik_skeleton *skeleton, const ik_vec2 *pose);
+
+
+
+/*
+ * Retrieves vertex positions for rendering pose, in the same order 
+ *  as ik_get_render_data.
+ */
+void ik_skeleton_get_render_data(const ik_skeleton *skeleton, const ik_vec2 *pose,
+                                 ik_vertex_buffer *buffer);
+
+
+
+/*
+ * Writes the same vertices as ik_skeleton_get_render_data to a range
+ *  reserved in 'pool', and returns index of the first, or -1 if pool
+ *  is full. May be called from several threads.
+ */
+int ik_skeleton_render_to_pool(const ik_skeleton *skeleton, const ik_vec2 *pose,
+                               ik_render_pool *pool);
+
+
+
+/*
+ * Linearly interpolates positions of poses 'a' and 'b' by 't', 
+ *  writing result to 'out'. Segment lengths are not preserved.
+ *  'out' may be the same array as 'a' or 'b'.
+ */
+void ik_pose_lerp(ik_vec2 *out, const ik_vec2 *a, const ik_vec2 *b, float t, int n_joints);
+
+
+
+/*
+ * Interpolates root position and segment directions of poses 'a' and 
+ *  'b' by 't', preserving segment lengths of 'skeleton'.
+ *  'out' may be the same array as 'a' or 'b'.
+ */
+void ik_pose_nlerp(const ik_skeleton *skeleton, ik_vec2 *out, 
+                   const ik_vec2 *a, const ik_vec2 *b, float t);
+
+
+
+/*
+ * Like ik_pose_nlerp, but segment ending at joint i is interpolated
+ *  by 'weights[i]', with weights[0] used for root position.
+ */
+void ik_pose_blend_masked(const ik_skeleton *skeleton, ik_vec2 *out,
+                          const ik_vec2 *a, const ik_vec2 *b, const float *weights);
+
+
+
+/*
+ * Sets weights of all joints in branch beginning at joint 'branch'
+ *  to 'weight', for use with ik_pose_blend_masked.
+ */
+void ik_pose_mask_branch(const ik_skeleton *skeleton, float *weights, int branch, float weight);
+
+
+
+/*
+ * Layers difference between poses 'additive' and 'reference' on top 
+ *  of 'base', scaled by 'weight'. Segments are rotated by the angle 
+ *  between their reference and additive directions, and root is 
+ *  translated. Segment lengths are preserved. 
+ *  'out' may be the same array as 'base'.
+ */
+void ik_pose_additive(const ik_skeleton *skeleton, ik_vec2 *out, const ik_vec2 *base,
+                      const ik_vec2 *reference, const ik_vec2 *additive, float weight);
+
+
+
+/*
+ * Creates a new pose buffer holding poses of 'n_joints' joints.
+ */
+ik_pose_buffer ik_new_pose_buffer(int n_joints);
+
+
+
+/*
+ * Frees buffer data, setting buffer to invalid state.
+ */
+void ik_free_pose_buffer(ik_pose_buffer *buffer);
+
+
+
+/*
+ * Returns pose to be written by the writing thread. The pose 
+ *  is not visible to the reader until published.
+ */
+ik_vec2 *ik_pose_buffer_back(ik_pose_buffer *buffer);
+
+
+
+/*
+ * Publishes back pose to the reader. Must only be called
+ *  from the writing thread.
+ */
+void ik_pose_buffer_publish(ik_pose_buffer *buffer);
+
+
+
+/*
+ * Writes positions of branch beginning at 'root' to back
+ *  pose and publishes it.
+ */
+void ik_publish_pose(ik_joint *root, ik_pose_buffer *buffer);
+
+
+
+/*
+ * Returns most recently published pose. The pose stays valid
+ *  until the next call from the reading thread, which is the
+ *  only thread allowed to call this function.
+ */
+const ik_vec2 *ik_pose_buffer_front(ik_pose_buffer *buffer);
+
+
+
+/*
+ * Define IK_NO_RECORDER to leave out recording and replay, or
+ *  IK_NO_STDIO to leave out everything using files, which is both
+ *  recording and ik_dump_telemetry.
+ */
+#if defined(IK_NO_STDIO) && !defined(IK_NO_RECORDER)
+# define IK_NO_RECORDER
+#endif
+
+#ifndef IK_NO_RECORDER
+
+/*
+ * Starts recording topology of tree beginning at 'root' and all 
+ *  subsequent calls to ik_solve, ik_solve_render, ik_solve_iterative
+ *  and ik_translate on joints of the tree, including solves through 
+ *  effectors, to binary log at 'path'. Replaces any active recording.
+ *  Branches attached to, detached from or moved within the tree, also
+ *  through joint pools, are recorded as well, so later calls replay on
+ *  the edited tree. Attaching 'root' to another tree ends recording.
+ *  Returns IK_ERROR if file can't be opened.
+ */
+int ik_record_begin(ik_joint *root, const char *path);
+
+
+
+/*
+ * Stops active recording, if any.
+ */
+void ik_record_end(void);
+
+
+
+/*
+ * Rebuilds tree from recording at 'path' and re-executes recorded calls,
+ *  timing them. 'stats' may be NULL.
+ * Returns IK_ERROR if file can't be read or is malformed.
+ */
+int ik_replay(const char *path, ik_replay_stats *stats);
+
+#endif /* IK_NO_RECORDER */
+
+
+
+#ifndef IK_NO_STDIO
+
+/*
+ * Appends summary and histograms of telemetry sink to text file at
+ *  'path', headed by 'label', so sinks of several rigs can be dumped
+ *  to one file. Returns IK_ERROR if file can't be opened.
+ */
+int ik_dump_telemetry(const ik_telemetry *telemetry, const char *label, const char *path);
+
+#endif /* IK_NO_STDIO */
+
+
+
+/*
+ * Creates a new vertex buffer.
+ */
+ik_vertex_buffer ik_new_vertex_buffer(void);
+
+
+
+/*
+ * Frees buffer data, setting buffer to invalid state.
+ */
+void ik_free_vertex_buffer(ik_vertex_buffer *buffer);
+
+
+
+/*
+ * Creates a render pool holding up to 'cap' vertices.
+ */
+ik_render_pool ik_new_render_pool(int cap);
+
+
+
+/*
+ * Frees pool data, setting pool to invalid state.
+ */
+void ik_free_render_pool(ik_render_pool *pool);
+
+
+
+/*
+ * Empties pool, e.g. at the start of a frame. Must not be called
+ *  while other threads write to the pool.
+ */
+void ik_render_pool_reset(ik_render_pool *pool);
+
+
+
+/*
+ * Reserves 'n_vertices' contiguous vertices in pool, returning index
+ *  of the first, or -1 if they don't fit. Safe to call from several
+ *  threads at once.
+ */
+int ik_render_pool_reserve(ik_render_pool *pool, int n_vertices);
+
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IKSOLVER_H */
+
+
+#ifdef IKSOLVER_IMPLEMENTATION
+
+/**********************************************
+ *                 UTILITY                    *
+ **********************************************/
+
+/*
+ * The implementation needs C11 for timespec_get and _Thread_local,
+ *  unless IK_CLOCK_NS and IK_THREAD_LOCAL are defined.
+ */
+
+#ifndef IK_MALLOC
+# include <stdlib.h>
+# define IK_MALLOC malloc
+# define IK_FREE   free
+#endif
+
+#include <stdint.h>
+
+#ifndef IK_SQRT
+# include <math.h>
+# define IK_SQRT sqrtf
+#endif
+
+/*
+ * Define IK_FAST_RSQRT to compute reciprocal square roots, used to
+ *  normalize directions, from the SSE or NEON estimate refined by one
+ *  Newton step, with relative error around 1e-6 instead of exact
+ *  rounding. Has no effect on other targets, or if IK_RSQRT is defined.
+ */
+#ifndef IK_RSQRT
+# if defined(IK_FAST_RSQRT) && (defined(__SSE__) || defined(_M_X64))
+#  include <xmmintrin.h>
+#  define IK_RSQRT_SSE
+static inline float ik_rsqrt(float x)
+{
+    float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return r * (1.5f - 0.5f * x * r * r);
+}
+# elif defined(IK_FAST_RSQRT) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+static inline float ik_rsqrt(float x)
+{
+    float32x2_t v = vdup_n_f32(x);
+    float32x2_t r = vrsqrte_f32(v);
+    r = vmul_f32(r, vrsqrts_f32(vmul_f32(v, r), r));
+    return vget_lane_f32(r, 0);
+}
+# else
+static inline float ik_rsqrt(float x)
+{
+    return 1.0f / IK_SQRT(x);
+}
+# endif
+# define IK_RSQRT ik_rsqrt
+#endif
+
+#ifndef IK_ATAN2
+# include <math.h>
+# define IK_ATAN2 atan2f
+# define IK_COS   cosf
+# define IK_SIN   sinf
+#endif
+
+#ifndef IK_MEMCPY
+# include <string.h>
+# define IK_MEMCPY memcpy
+#endif
+
+#ifndef IK_THREAD_LOCAL
+# ifdef __cplusplus
+#  define IK_THREAD_LOCAL thread_local
+# else
+#  define IK_THREAD_LOCAL _Thread_local
+# endif
+#endif
+
+#ifndef NULL
+# define NULL ((void*)0)
+#endif
+
+/*
+ * Define IK_ALLOCATOR to allow setting allocators at runtime with
+ *  ik_set_allocator. Every block then begins with a header recording
+ *  how to free it, so blocks can be freed after the allocator is
+ *  changed, or on another thread. The header keeps blocks aligned to
+ *  16 bytes. Without it, blocks come straight from IK_MALLOC.
+ */
+#ifdef IK_ALLOCATOR
+
+typedef struct {
+    void (*free)(void *user, void *ptr, size_t size);
+    void *user;
+    size_t size;
+} ik_block_header;
+
+#define IK_BLOCK_HEADER ((sizeof(ik_block_header) + 15) / 16 * 16)
+
+static IK_THREAD_LOCAL ik_allocator ik_thread_allocator;
+
+static void *ik_malloc(size_t size)
+{
+    const ik_allocator *allocator = &ik_thread_allocator;
+    size += IK_BLOCK_HEADER;
+
+    ik_block_header *header = allocator->alloc ? allocator->alloc(allocator->user, size)
+                                               : IK_MALLOC(size);
+    header->free = allocator->alloc ? allocator->free : NULL;
+    header->user = allocator->user;
+    header->size = size;
+    return (char*)header + IK_BLOCK_HEADER;
+}
+
+static void ik_free(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    ik_block_header *header = (ik_block_header*)((char*)ptr - IK_BLOCK_HEADER);
+    if(header->free)
+        header->free(header->user, header, header->size);
+    else
+        IK_FREE(header);
+}
+
+#else
+
+static void *ik_malloc(size_t size)
+{
+    return IK_MALLOC(size);
+}
+
+static void ik_free(void *ptr)
+{
+    if(ptr)
+        IK_FREE(ptr);
+}
+
+#endif /* IK_ALLOCATOR */
+
+#ifndef IK_ATOMIC_EXCHANGE
+# define IK_ATOMIC_EXCHANGE(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL)
+# define IK_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+# define IK_ATOMIC_ADD(ptr, value) __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL)
+# define IK_ATOMIC_COMPARE_EXCHANGE(ptr, expected, value) \
+    __atomic_compare_exchange_n(ptr, expected, value, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#endif
+
+#ifndef IK_CLOCK_NS
+# include <time.h>
+static inline long long ik_clock_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+# define IK_CLOCK_NS ik_clock_ns
+#endif
+
+#ifndef IK_NO_STDIO
+# include <stdio.h>
+#endif
+
+#ifdef IK_PARALLEL
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+#ifdef IK_DEBUG
+# include <stdio.h>
+# define LOG(msg, ...) printf(msg "\n", __VA_ARGS__)
+# define INDENT() indent++
+# define UNINDENT() indent--
+static int indent = 0;
+#else
+# define LOG(msg, ...)
+# define INDENT()
+# define UNINDENT()
+#endif
+
+
+/**********************************************
+ *             INTERNAL FUNCTIONS             *
+ **********************************************/
+
+/*
+ * Calculates length of vector (x, y)
+ */
+static inline float length(float x, float y)
+{
+    return IK_SQRT(x * x + y * y);
+}
+
+
+
+
+
+/*
+ * Wraps angle to range [-pi, pi].
+ */
+static inline float ik_wrap_angle(float angle)
+{
+    const float pi = 3.14159265f;
+
+    while(angle > pi)
+        angle -= 2.0f * pi;
+    while(angle < -pi)
+        angle += 2.0f * pi;
+
+    return angle;
+}
+
+
+
+/*
+ * Clamps angle of direction (dx, dy) relative to reference direction
+ *  (ref_x, ref_y) to [min_angle, max_angle], keeping length of direction.
+ *  Rotates to whichever limit is closest.
+ */
+static void ik_clamp_direction(float ref_x, float ref_y, float *dx, float *dy,
+                               float min_angle, float max_angle)
+{
+    float angle = IK_ATAN2(ref_x * *dy - ref_y * *dx, ref_x * *dx + ref_y * *dy);
+
+    if(angle >= min_angle && angle <= max_angle)
+        return;
+
+    float ref_len = length(ref_x, ref_y);
+    if(ref_len == 0.0f)
+        return;
+
+    float to_min = ik_wrap_angle(angle - min_angle);
+    float to_max = ik_wrap_angle(angle - max_angle);
+    float clamped = (to_min < 0.0f ? -to_min : to_min) < (to_max < 0.0f ? -to_max : to_max) ?
+        min_angle : max_angle;
+
+    float dir_len = length(*dx, *dy);
+
+    LOG("Clamping angle %f to %f", angle, clamped);
+    float C = IK_COS(clamped), S = IK_SIN(clamped);
+    float scale = dir_len / ref_len;
+    *dx = scale * (C * ref_x - S * ref_y);
+    *dy = scale * (S * ref_x + C * ref_y);
+}
+
+
+
+/*
+ * Places position at 'distance' from 'origin', in direction (dx, dy).
+ *  Position is left unchanged if direction has zero length.
+ */
+static inline void ik_place_at_dist(ik_vec2 *position, ik_vec2 origin, float distance, float dx, float dy)
+{
+    float length2 = dx * dx + dy * dy;
+
+    if(length2 == 0.0f)
+        return;
+
+    float scale = distance * IK_RSQRT(length2);
+    position->x = origin.x + scale * dx;
+    position->y = origin.y + scale * dy;
+}
+
+
+
+/*
+ * Scales each of 'n' vectors to the corresponding length, leaving zero
+ *  vectors unchanged. Vectors are independent, so with IK_FAST_RSQRT
+ *  on SSE four are normalized at a time.
+ */
+static void ik_scale_to_lengths(ik_vec2 *v, const float *lengths, int n)
+{
+    int i = 0;
+
+#ifdef IK_RSQRT_SSE
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 v01 = _mm_loadu_ps(&v[i].x);
+        __m128 v23 = _mm_loadu_ps(&v[i + 2].x);
+        __m128 xs = _mm_shuffle_ps(v01, v23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 ys = _mm_shuffle_ps(v01, v23, _MM_SHUFFLE(3, 1, 3, 1));
+
+        __m128 length2 = _mm_add_ps(_mm_mul_ps(xs, xs), _mm_mul_ps(ys, ys));
+        __m128 r = _mm_rsqrt_ps(length2);
+        r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f),
+            _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), length2), _mm_mul_ps(r, r))));
+
+        /* Zero vectors get scale 0 instead of infinity */
+        __m128 nonzero = _mm_cmpneq_ps(length2, _mm_setzero_ps());
+        __m128 scale = _mm_and_ps(_mm_mul_ps(r, _mm_loadu_ps(&lengths[i])), nonzero);
+
+        xs = _mm_mul_ps(xs, scale);
+        ys = _mm_mul_ps(ys, scale);
+        _mm_storeu_ps(&v[i].x, _mm_unpacklo_ps(xs, ys));
+        _mm_storeu_ps(&v[i + 2].x, _mm_unpackhi_ps(xs, ys));
+    }
+#endif
+
+    ik_vec2 origin = { 0.0f, 0.0f };
+    for(; i < n; i++)
+        ik_place_at_dist(&v[i], origin, lengths[i], v[i].x, v[i].y);
+}
+
+
+
+/*
+ * Places joint at exact segment length from parent, in direction (dx, dy).
+ */
+static inline void ik_snap_to_parent(ik_joint *joint, float dx, float dy)
+{
+    ik_place_at_dist(&joint->position, joint->parent->position, joint->length, dx, dy);
+}
+
+
+
+/*
+ * Constrains position placed during forward reach, relative to
+ *  the final segment between 'parent' and 'grandparent'.
+ */
+static inline void ik_constrain_forward(ik_vec2 *position, ik_vec2 parent, ik_vec2 grandparent,
+                                        float min_angle, float max_angle)
+{
+    float dx = position->x - parent.x;
+    float dy = position->y - parent.y;
+
+    ik_clamp_direction(
+        parent.x - grandparent.x,
+        parent.y - grandparent.y,
+        &dx, &dy, min_angle, max_angle);
+
+    position->x = parent.x + dx;
+    position->y = parent.y + dy;
+}
+
+
+
+/*
+ * Constrains position placed during back reach, by rotating it around 
+ *  'child' so that the constraint of 'grandchild' is satisfied.
+ */
+static inline void ik_constrain_back(ik_vec2 *position, ik_vec2 child, ik_vec2 grandchild,
+                                     float min_angle, float max_angle)
+{
+    float dx = child.x - position->x;
+    float dy = child.y - position->y;
+
+    ik_clamp_direction(
+        grandchild.x - child.x,
+        grandchild.y - child.y,
+        &dx, &dy, -max_angle, -min_angle);
+
+    position->x = child.x - dx;
+    position->y = child.y - dy;
+}
+
+
+
+
+
+/*
+ * Scratch memory for temporary data of a solve, kept per thread.
+ *  Allocations are released in reverse order by returning to a mark
+ *  taken before them. When a block is full, another is chained on top.
+ *  Once all memory is released, chained blocks are replaced by a
+ *  single block as large as the most memory used, so a thread
+ *  repeating similar solves stops allocating after the first.
+ */
+struct ik_scratch_block {
+    struct ik_scratch_block *prev;
+    unsigned long cap;
+    unsigned long used;
+};
+
+#define IK_SCRATCH_ALIGN 16
+#define IK_SCRATCH_MIN_BLOCK 4096
+#define IK_SCRATCH_HEADER \
+    ((sizeof(struct ik_scratch_block) + IK_SCRATCH_ALIGN - 1) / IK_SCRATCH_ALIGN * IK_SCRATCH_ALIGN)
+
+static IK_THREAD_LOCAL struct {
+    struct ik_scratch_block *top;
+    unsigned long in_use;
+    unsigned long peak;
+} ik_scratch;
+
+static struct ik_scratch_block *ik_scratch_new_block(unsigned long cap, struct ik_scratch_block *prev)
+{
+    struct ik_scratch_block *block = ik_malloc(IK_SCRATCH_HEADER + cap);
+    block->prev = prev;
+    block->cap = cap;
+    block->used = 0;
+    return block;
+}
+
+static void *ik_scratch_alloc(unsigned long size)
+{
+    size = (size + IK_SCRATCH_ALIGN - 1) / IK_SCRATCH_ALIGN * IK_SCRATCH_ALIGN;
+
+    struct ik_scratch_block *top = ik_scratch.top;
+    if(!top || top->used + size > top->cap)
+    {
+        unsigned long cap = top ? top->cap * 2 : IK_SCRATCH_MIN_BLOCK;
+        while(cap < size)
+            cap *= 2;
+        top = ik_scratch.top = ik_scratch_new_block(cap, top);
+    }
+
+    void *data = (char*)top + IK_SCRATCH_HEADER + top->used;
+    top->used += size;
+
+    ik_scratch.in_use += size;
+    if(ik_scratch.in_use > ik_scratch.peak)
+        ik_scratch.peak = ik_scratch.in_use;
+    return data;
+}
+
+static inline unsigned long ik_scratch_mark(void)
+{
+    return ik_scratch.in_use;
+}
+
+/*
+ * Releases all scratch memory allocated after 'mark' was taken.
+ */
+static void ik_scratch_release(unsigned long mark)
+{
+    unsigned long n_free = ik_scratch.in_use - mark;
+    ik_scratch.in_use = mark;
+
+    while(n_free > 0)
+    {
+        struct ik_scratch_block *top = ik_scratch.top;
+        if(top->used >= n_free)
+        {
+            top->used -= n_free;
+            break;
+        }
+
+        n_free -= top->used;
+        top->used = 0;
+        if(top->prev)
+        {
+            ik_scratch.top = top->prev;
+            ik_free(top);
+        }
+    }
+
+    /* Merge blocks, so that the most memory used fits in one */
+    if(mark == 0 && ik_scratch.top && ik_scratch.top->cap < ik_scratch.peak)
+    {
+        ik_free_scratch();
+        ik_scratch.top = ik_scratch_new_block(ik_scratch.peak, NULL);
+    }
+}
+
+
+
+/*
+ * Stack for pushing ik_joint pointers to during back reach, so that
+ *  we know which path to take when reaching forward. Lives in scratch
+ *  memory and grows as needed, see ik_stack_begin.
+ */
+static IK_THREAD_LOCAL struct {
+    ik_joint **data;
+    int size;
+    int cap;
+} ik_stack;
+
+#define IK_STACK_INITIAL_SIZE 64
+
+static inline void ik_stack_begin(void)
+{
+    ik_stack.data = ik_scratch_alloc(sizeof(ik_joint*) * IK_STACK_INITIAL_SIZE);
+    ik_stack.size = 0;
+    ik_stack.cap = IK_STACK_INITIAL_SIZE;
+}
+
+static inline void ik_stack_push(ik_joint *joint)
+{
+    LOG("Pushing joint %p", joint);
+    if(ik_stack.size == ik_stack.cap)
+    {
+        ik_joint **data = ik_scratch_alloc(sizeof(ik_joint*) * ik_stack.cap * 2);
+        IK_MEMCPY(data, ik_stack.data, sizeof(ik_joint*) * ik_stack.size);
+        ik_stack.data = data;
+        ik_stack.cap *= 2;
+    }
+    ik_stack.data[ik_stack.size++] = joint;
+}
+
+static inline ik_joint *ik_stack_pop(void)
+{
+    if(ik_stack.size == 0)
+        return NULL;
+
+    ik_joint *joint = ik_stack.data[--ik_stack.size];
+    LOG("Popping joint %p", joint);
+    return joint;
+}
+
+static inline ik_joint *ik_stack_top(void)
+{
+    if(ik_stack.size == 0)
+        return NULL;
+
+    return ik_stack.data[ik_stack.size - 1];
+}
+
+
+
+/*
+ * Pushes vector to buffer.
+ */
+static void ik_vertex_buffer_push(ik_vertex_buffer *buffer, ik_vec2 value)
+{
+    if(buffer->size == buffer->cap)
+    {
+        int new_cap = buffer->cap ? buffer->cap * 2 : 10;
+        ik_vec2 *new_data = ik_malloc(sizeof(ik_vec2) * new_cap);
+
+        IK_MEMCPY(new_data, buffer->data, sizeof(ik_vec2) * buffer->size);
+        ik_free(buffer->data);
+
+        buffer->data = new_data;
+        buffer->cap = new_cap;
+    }
+
+    buffer->data[buffer->size++] = value;
+}
+
+
+/*
+ * Resets buffer data
+ */
+static void ik_vertex_buffer_reset(ik_vertex_buffer *buffer) 
+{
+    buffer->size = 0;
+}
+
+
+
+/*
+ * Pushes segment from 'joint' to it's parent, if 'emit' is not NULL.
+ */
+static inline void ik_emit_segment(ik_vertex_buffer *emit, ik_joint *joint)
+{
+    if(!emit)
+        return;
+
+    ik_vertex_buffer_push(emit, joint->parent->position);
+    ik_vertex_buffer_push(emit, joint->position);
+}
+
+
+
+/*
+ * Struct to represent entries of rotation matrix.
+ *
+ *  C: cos(abs(angle))
+ *  S: sin(abs(angle))
+ *  P: sgn(angle)
+ *
+ */
+struct ik_matrix { float C, S, P; };
+
+
+
+/*
+ * Finds rotation matrix entries for rotation from direction
+ *  'from' to direction 'to'.
+ */
+static inline struct ik_matrix ik_find_matrix(ik_vec2 from, ik_vec2 to)
+{
+    struct ik_matrix mat;
+
+    /* C = cos(angle) */
+    float C_denom = length(from.x, from.y) * length(to.x, to.y);
+    mat.C = (from.x * to.x + from.y * to.y) / C_denom;
+    
+    /* S = sin(angle) */
+    float S2 = 1 - mat.C * mat.C;
+    mat.S = IK_SQRT(S2 > 0.0f ? S2 : 0.0f);
+
+    /* P = sgn(angle) */
+    mat.P = from.x * to.y - from.y * to.x > 0.0f ? 1.0f : -1.0f;
+
+    return mat;
+}
+
+
+
+/*
+ * Translates position by offset, then rotates it around pivot.
+ */
+static inline void ik_transform_point(ik_vec2 *position, ik_vec2 pivot, struct ik_matrix mat, ik_vec2 offset)
+{
+    /* Translate */
+    position->x += offset.x;
+    position->y += offset.y;
+
+    /* Rotate */
+    position->x -= pivot.x;
+    position->y -= pivot.y;
+
+    float tmp_x = position->x;
+
+    /* P is applied using identies cos(-a) = cos(a), sin(-a) = -sin(a) */
+    position->x = (mat.C        ) * position->x + (-mat.P * mat.S) * position->y;
+    position->y = (mat.P * mat.S) * tmp_x       + ( mat.C        ) * position->y;
+
+    position->x += pivot.x;
+    position->y += pivot.y;
+}
+
+
+
+/*
+ * State of deferred alignment of the calling thread. 'n_pending' counts
+ *  joints with pending transforms, so flushing can return early when
+ *  there are none. Iterative solvers rotate through pending transforms
+ *  even when deferred alignment is disabled, so this must not be shared
+ *  by threads solving separate trees.
+ */
+static IK_THREAD_LOCAL struct {
+    int enabled;
+    int n_pending;
+} ik_deferred;
+
+
+
+/*
+ * Converts rotation around pivot after translation by offset, as 
+ *  applied by ik_transform_point, to rigid transform.
+ */
+static inline ik_transform ik_make_transform(ik_vec2 pivot, struct ik_matrix mat, ik_vec2 offset)
+{
+    ik_transform t;
+    t.c = mat.C;
+    t.s = mat.P * mat.S;
+
+    /* R (p + offset - pivot) + pivot = R p + R (offset - pivot) + pivot */
+    float dx = offset.x - pivot.x;
+    float dy = offset.y - pivot.y;
+    t.tx = t.c * dx - t.s * dy + pivot.x;
+    t.ty = t.s * dx + t.c * dy + pivot.y;
+
+    return t;
+}
+
+
+
+/*
+ * Applies rigid transform to position.
+ */
+static inline void ik_apply_transform(ik_vec2 *position, ik_transform t)
+{
+    float x = position->x;
+    position->x = t.c * x - t.s * position->y + t.tx;
+    position->y = t.s * x + t.c * position->y + t.ty;
+}
+
+
+
+/*
+ * Adds transform 't' to pending transforms of branch, to be applied 
+ *  after those already pending.
+ */
+static void ik_compose_pending(ik_joint *root, ik_transform t)
+{
+    if(!root->has_pending)
+    {
+        root->pending = t;
+        root->has_pending = 1;
+        ik_deferred.n_pending++;
+        return;
+    }
+
+    /* t(p(x)) = Rt Rp x + Rt tp + tt */
+    ik_transform p = root->pending;
+    float c = t.c * p.c - t.s * p.s;
+    float s = t.s * p.c + t.c * p.s;
+    root->pending.tx = t.c * p.tx - t.s * p.ty + t.tx;
+    root->pending.ty = t.s * p.tx + t.c * p.ty + t.ty;
+
+    /* Rounding would otherwise build up into scaling of the branch */
+    float scale = IK_RSQRT(c * c + s * s);
+    root->pending.c = c * scale;
+    root->pending.s = s * scale;
+}
+
+
+
+/*
+ * Applies pending transform of 'joint' to its position, and passes it
+ *  on to its children.
+ */
+static void ik_push_down_pending(ik_joint *joint)
+{
+    LOG("Applying pending transform of %p", joint);
+    ik_apply_transform(&joint->position, joint->pending);
+
+#ifdef IK_RENORMALIZE
+    if(joint->parent)
+        ik_snap_to_parent(joint,
+            joint->position.x - joint->parent->position.x,
+            joint->position.y - joint->parent->position.y);
+#endif
+
+    for(int i = 0; i < joint->n_children; i++)
+        ik_compose_pending(joint->children[i], joint->pending);
+
+    joint->has_pending = 0;
+    ik_deferred.n_pending--;
+}
+
+
+
+/*
+ * Applies pending transforms of 'joint' and its ancestors, so that
+ *  positions along path from root to 'joint' are up to date.
+ */
+static void ik_flush_path(ik_joint *joint)
+{
+    if(joint->parent)
+        ik_flush_path(joint->parent);
+
+    if(joint->has_pending)
+        ik_push_down_pending(joint);
+}
+
+
+
+/*
+ * Applies all pending transforms in branch.
+ */
+static void ik_flush_branch(ik_joint *root)
+{
+    if(root->has_pending)
+        ik_push_down_pending(root);
+
+    for(int i = 0; i < root->n_children; i++)
+        ik_flush_branch(root->children[i]);
+}
+
+
+
+/* 
+ * Aligns branch according to precalculated values.
+ *
+ *  root: root joint of branch to be aligned
+ *  pivot: position to rotate around
+ *  mat: entries of rotation matrix
+ *  offset: offset to translate
+ *  emit: buffer to push render segments to, or NULL
+ * 
+ * Define IK_RENORMALIZE to restore segment lengths while aligning,
+ *  preventing accumulation of rounding errors over many solves.
+ * 
+ */
+static void ik_align_branch_precalc(ik_joint *root, ik_vec2 pivot, struct ik_matrix mat, ik_vec2 offset,
+                                    ik_vertex_buffer *emit)
+{
+    LOG("Aligning branch %p", root);
+
+    ik_transform_point(&root->position, pivot, mat, offset);
+
+#ifdef IK_RENORMALIZE
+    /* Parent is already aligned, so restore length relative to it */
+    ik_snap_to_parent(root,
+        root->position.x - root->parent->position.x,
+        root->position.y - root->parent->position.y);
+#endif
+
+    ik_emit_segment(emit, root);
+
+    /* Recurse */
+    /* TODO: Use stack instead of recursion? */
+    for(int i = 0; i < root->n_children; i++)
+        ik_align_branch_precalc(root->children[i], pivot, mat, offset, emit);
+}
+
+
+
+/* 
+ * This function is used for translating/rotating branches that are not
+ *  affected by back or forward reach.
+ * 
+ *  root: root joint of branch to be aligned
+ *  from: previous position of root's parent, relative to it's parent
+ *  to: new position of root's parent, relative to it's parent
+ *  emit: buffer to push render segments to, or NULL
+ * 
+ */
+static void ik_align_branch(ik_joint *root, ik_vec2 from, ik_vec2 to, ik_vertex_buffer *emit)
+{
+    /* Find rotation matrix entries */
+    struct ik_matrix mat = ik_find_matrix(from, to);
+
+
+    /* Find offset */
+    ik_vec2 offset;
+    offset.x = to.x - from.x;
+    offset.y = to.y - from.y;
+
+    /* Use parents position as pivot, as rotation takes place after translation */
+    LOG("Aligning branch %p, C = %f, S = %f, P = %f, offset = (%f, %f)",
+            root, mat.C, mat.S, mat.P, offset.x, offset.y);
+
+    /* Emitting requires final positions, so never defer then */
+    if(ik_deferred.enabled && !emit)
+    {
+        ik_compose_pending(root, ik_make_transform(root->parent->position, mat, offset));
+        return;
+    }
+
+    if(ik_deferred.n_pending)
+        ik_flush_branch(root);
+    ik_align_branch_precalc(root, root->parent->position, mat, offset, emit);
+}
+
+
+
+/*
+ * Translates branch by offset, used from ik_align_branch_only_translate.
+ */
+static void ik_translate_branch(ik_joint *root, float offset_x, float offset_y,
+                                ik_vertex_buffer *emit)
+{
+    LOG("Translating branch %p", root);
+    root->position.x += offset_x;
+    root->position.y += offset_y;
+
+    ik_emit_segment(emit, root);
+
+    for(int i = 0; i < root->n_children; i++)
+        ik_translate_branch(root->children[i], offset_x, offset_y, emit);
+}
+
+
+
+/*
+ * Translates branch by offset.
+ * Used to align branch who's parent is the tree root.
+ */
+static void ik_align_branch_only_translate(ik_joint *root, float offset_x, float offset_y,
+                                           ik_vertex_buffer *emit)
+{
+    if(ik_deferred.enabled && !emit)
+    {
+        ik_transform t = { 1.0f, 0.0f, offset_x, offset_y };
+        ik_compose_pending(root, t);
+        return;
+    }
+
+    if(ik_deferred.n_pending)
+        ik_flush_branch(root);
+    ik_translate_branch(root, offset_x, offset_y, emit);
+}
+
+
+
+/*
+ * Returns number of joints in branch, counting again below joints
+ *  whose branch changed. Afterwards the whole branch is counted.
+ */
+static int ik_subtree_size(ik_joint *root)
+{
+    if(root->subtree_size == 0)
+    {
+        int size = 1;
+        for(int i = 0; i < root->n_children; i++)
+            size += ik_subtree_size(root->children[i]);
+        root->subtree_size = size;
+    }
+    return root->subtree_size;
+}
+
+
+
+/*
+ * Marks branch sizes of 'joint' and it's ancestors for counting again.
+ *  Ancestors of a marked joint are marked as well, so this stops at the
+ *  first marked one, and repeated edits of a tree take constant time.
+ */
+static void ik_invalidate_subtree_size(ik_joint *joint)
+{
+    for(; joint && joint->subtree_size; joint = joint->parent)
+        joint->subtree_size = 0;
+}
+
+
+
+#ifdef IK_PARALLEL
+
+/*
+ * Work stealing pool for aligning branches in parallel. Each thread owns 
+ *  a queue, where it pushes and pops tasks at the bottom, while other 
+ *  threads steal from the top. Queue 0 belongs to the solving thread.
+ */
+
+#define IK_PARALLEL_MAX_THREADS 64
+#define IK_PARALLEL_QUEUE_SIZE  1024
+
+struct ik_task {
+    ik_joint *root;
+    ik_vec2 pivot;
+    struct ik_matrix mat;
+    ik_vec2 offset;
+};
+
+struct ik_task_queue {
+    pthread_mutex_t lock;
+    int top, bottom;    /* tasks in [top, bottom), modulo queue size */
+    struct ik_task tasks[IK_PARALLEL_QUEUE_SIZE];
+};
+
+static struct {
+    int running;
+    int n_threads;      /* threads started, only used by the starting thread */
+    int n_queues;       /* fixed before any worker starts */
+    int min_branch_size;
+    int pending;        /* tasks pushed but not yet finished */
+
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    pthread_t threads[IK_PARALLEL_MAX_THREADS];
+    struct ik_task_queue *queues;
+} ik_workers;
+
+
+static int ik_queue_push(struct ik_task_queue *queue, struct ik_task task)
+{
+    int ok = 0;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->bottom - queue->top < IK_PARALLEL_QUEUE_SIZE)
+    {
+        queue->tasks[queue->bottom++ % IK_PARALLEL_QUEUE_SIZE] = task;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ok;
+}
+
+
+static int ik_queue_take(struct ik_task_queue *queue, struct ik_task *task, int steal)
+{
+    int ok = 0;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->top < queue->bottom)
+    {
+        *task = steal ? queue->tasks[queue->top++ % IK_PARALLEL_QUEUE_SIZE]
+                      : queue->tasks[--queue->bottom % IK_PARALLEL_QUEUE_SIZE];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ok;
+}
+
+
+/*
+ * Takes task from own queue, or steals one from another thread.
+ */
+static int ik_workers_find_task(int self, struct ik_task *task)
+{
+    if(ik_queue_take(&ik_workers.queues[self], task, 0))
+        return 1;
+
+    for(int i = 1; i < ik_workers.n_queues; i++)
+        if(ik_queue_take(&ik_workers.queues[(self + i) % ik_workers.n_queues], task, 1))
+            return 1;
+
+    return 0;
+}
+
+
+/*
+ * Pushes task aligning branch, returning 0 if queue is full.
+ */
+static int ik_workers_push(int self, ik_joint *root, ik_vec2 pivot, struct ik_matrix mat, ik_vec2 offset)
+{
+    struct ik_task task = { root, pivot, mat, offset };
+
+    IK_ATOMIC_ADD(&ik_workers.pending, 1);
+    if(!ik_queue_push(&ik_workers.queues[self], task))
+    {
+        IK_ATOMIC_ADD(&ik_workers.pending, -1);
+        return 0;
+    }
+
+    pthread_mutex_lock(&ik_workers.sleep_lock);
+    pthread_cond_broadcast(&ik_workers.wake);
+    pthread_mutex_unlock(&ik_workers.sleep_lock);
+    return 1;
+}
+
+
+/*
+ * Aligns branch like ik_align_branch_precalc, pushing large sibling
+ *  branches as separate tasks.
+ */
+static void ik_workers_align(int self, ik_joint *root, ik_vec2 pivot, struct ik_matrix mat, ik_vec2 offset)
+{
+    ik_transform_point(&root->position, pivot, mat, offset);
+
+#ifdef IK_RENORMALIZE
+    ik_snap_to_parent(root,
+        root->position.x - root->parent->position.x,
+        root->position.y - root->parent->position.y);
+#endif
+
+    for(int i = 0; i < root->n_children; i++)
+    {
+        ik_joint *child = root->children[i];
+
+        /* A single child gives nothing to run in parallel with */
+        if(root->n_children == 1 || child->subtree_size < ik_workers.min_branch_size 
+            || !ik_workers_push(self, child, pivot, mat, offset))
+            ik_workers_align(self, child, pivot, mat, offset);
+    }
+}
+
+
+static void ik_workers_execute(int self, struct ik_task *task)
+{
+    ik_workers_align(self, task->root, task->pivot, task->mat, task->offset);
+    IK_ATOMIC_ADD(&ik_workers.pending, -1);
+}
+
+
+static void *ik_worker_main(void *arg)
+{
+    int self = (int)(long)arg;
+    struct ik_task task;
+
+    while(IK_ATOMIC_LOAD(&ik_workers.running))
+    {
+        if(ik_workers_find_task(self, &task))
+        {
+            ik_workers_execute(self, &task);
+            continue;
+        }
+
+        /* Keep looking while tasks are outstanding, as they may split */
+        if(IK_ATOMIC_LOAD(&ik_workers.pending))
+        {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&ik_workers.sleep_lock);
+        if(IK_ATOMIC_LOAD(&ik_workers.running) && !IK_ATOMIC_LOAD(&ik_workers.pending))
+            pthread_cond_wait(&ik_workers.wake, &ik_workers.sleep_lock);
+        pthread_mutex_unlock(&ik_workers.sleep_lock);
+    }
+    return NULL;
+}
+
+
+/*
+ * Aligns branches of children of 'joint' except 'path_child' in
+ *  parallel, returning when all are aligned.
+ */
+static void ik_workers_align_children(ik_joint *joint, ik_joint *path_child, ik_vec2 pivot,
+                                   struct ik_matrix mat, ik_vec2 offset)
+{
+    /* Count branches here, so that workers only read sizes */
+    for(int i = 0; i < joint->n_children; i++)
+        ik_subtree_size(joint->children[i]);
+
+    /* Hand out large branches first, so workers start early */
+    for(int i = 0; i < joint->n_children; i++)
+    {
+        ik_joint *child = joint->children[i];
+
+        if(child != path_child && child->subtree_size >= ik_workers.min_branch_size
+            && ik_workers_push(0, child, pivot, mat, offset))
+            continue;
+        if(child != path_child)
+            ik_workers_align(0, child, pivot, mat, offset);
+    }
+
+    struct ik_task task;
+    while(IK_ATOMIC_LOAD(&ik_workers.pending))
+    {
+        if(ik_workers_find_task(0, &task))
+            ik_workers_execute(0, &task);
+        else
+            sched_yield();
+    }
+}
+
+#endif /* IK_PARALLEL */
+
+
+
+/*
+ * Aligns branches of all children of 'joint' except 'path_child' (which
+ *  may be NULL), after 'joint' has been moved from (org_x, org_y).
+ */
+static void ik_align_children(ik_joint *joint, ik_joint *path_child, float org_x, float org_y,
+                              ik_vertex_buffer *emit)
+{
+#ifdef IK_PARALLEL
+    if(ik_workers.running && !emit && !ik_deferred.enabled && !ik_deferred.n_pending)
+    {
+        struct ik_matrix mat = { 1.0f, 0.0f, 1.0f };
+        ik_vec2 offset = { joint->position.x - org_x, joint->position.y - org_y };
+
+        if(joint->parent)
+        {
+            ik_vec2 from = { org_x - joint->parent->position.x, org_y - joint->parent->position.y };
+            ik_vec2 to = { joint->position.x - joint->parent->position.x, 
+                           joint->position.y - joint->parent->position.y };
+            mat = ik_find_matrix(from, to);
+        }
+
+        ik_workers_align_children(joint, path_child, joint->position, mat, offset);
+        return;
+    }
+#endif
+
+    if(joint->parent)
+    {
+        LOG("%s", "Aligning child branches");
+        ik_vec2 from, to;
+
+        from.x = org_x - joint->parent->position.x;
+        from.y = org_y - joint->parent->position.y;
+
+        to.x = joint->position.x - joint->parent->position.x;
+        to.y = joint->position.y - joint->parent->position.y;
+        
+        for(int i = 0; i < joint->n_children; i++)
+        {
+            ik_joint *child = joint->children[i];
+
+            if(child != path_child)
+                ik_align_branch(child, from, to, emit);
+        }
+    } else {
+        /* Root of whole tree -> no parent to define orientation */
+        /*  -> only translate                                    */
+        LOG("%s", "Translating child branches");
+        for(int i = 0; i < joint->n_children; i++)
+        {
+            ik_joint *child = joint->children[i];
+
+            if(child != path_child)
+                ik_align_branch_only_translate(
+                    child, 
+                    joint->position.x - org_x, 
+                    joint->position.y - org_y,
+                    emit);
+        }
+    }
+}
+
+
+
+/*
+ * Moves joint within distance of target.
+ */
+static inline void ik_move_within_dist(ik_vec2 *position, float distance, float target_x, float target_y)
+{
+    LOG("Moving joint at %p within distance %f of (%f, %f)", position, distance, target_x, target_y);
+    float dx = position->x - target_x;
+    float dy = position->y - target_y;
+    float length2 = dx * dx + dy * dy;
+
+    if(length2 == 0.0f)
+    {
+        position->x = target_x;
+        position->y = target_y;
+    } else {
+        float scale = distance * IK_RSQRT(length2);
+        position->x = target_x + scale * dx;
+        position->y = target_y + scale * dy;
+    }
+}
+
+
+
+/*
+ * This functions iterates backwards, and must be followed immediatly
+ *  by ik_reach_forward, as joint pointers are push to the stack.
+ * Distance must be zero, and 'child' and 'grandchild' must be NULL 
+ *  when function is called from outside itself.
+ * 
+ * Since joints are placed in reverse, the constraint of 'grandchild' is
+ *  enforced by rotating 'effected' around 'child'.
+ * 
+ * Since this function traverses tree to the root, the three last arguments provide
+ *  access to the root joint, and its original position, which is used for forward reach.
+ * 
+ */
+static void ik_reach_back(ik_joint *effected, ik_joint *child, ik_joint *grandchild,
+                          float target_x, float target_y, float distance,
                           ik_joint **root, float *root_org_x, float *root_org_y)
 {
-    LOG("Reach back from joint %p, distance %f", effected, distance);
-    float org_x = effected->position.x;
-    float org_y = effected->position.y;
+    LOG("Reach back from joint %p, distance %f", effected, distance);
+    float org_x = effected->position.x;
+    float org_y = effected->position.y;
+
+    /* If reached root, save original position */
+    if(!effected->parent)
+    {
+        LOG("%s", "Is root");
+        *root = effected;
+        *root_org_x = org_x;
+        *root_org_y = org_y;
+    }
+
+
+    /* Move effected towards target */
+    ik_move_within_dist(&effected->position, distance, target_x, target_y);
+
+    if(grandchild && grandchild->constrained)
+        ik_constrain_back(&effected->position, child->position, grandchild->position,
+                          grandchild->min_angle, grandchild->max_angle);
+
+    /* If effected joints have more than one child, the other */
+    /*  children's branches must be aligned according to new  */
+    /*  orientation.                                          */
+    if(effected->n_children > 1) {
+
+        LOG("Has %d children", effected->n_children);
+        ik_align_children(effected, ik_stack_top(), org_x, org_y, NULL);
+    }
+    
+
+
+    /* Terminate if we've reached root */
+    if(!effected->parent)
+        return;
+
+
+    /* If 'effected' has siblings, push 'effected' to stack     */
+    /*  so that we know which path to take during forward reach */
+    if(effected->parent->n_children > 1) {
+        LOG("%s", "Push joint to path");
+        ik_stack_push(effected);
+    }
+
+    /* Recurse */
+    /* TODO: Use stack ? */
+    ik_reach_back(
+        effected->parent, 
+        effected,
+        child,
+        effected->position.x,
+        effected->position.y,
+        effected->length,
+        root, root_org_x, root_org_y);
+}
+
+
+
+/*
+ * This function iterates forward along path pushed to the stack by
+ *  ik_reach_back, and aligns the remaining branches.
+ * 
+ * If 'emit' is not NULL, render segments are pushed to it as joints reach
+ *  their final positions. Segments ending at path joints are reserved 
+ *  before the joint is moved, with 'emit_slot' giving the reserved index
+ *  (-1 if there is none).
+ * 
+ */
+static void ik_reach_forward(ik_joint *root, float distance, float target_x, float target_y,
+                             ik_vertex_buffer *emit, int emit_slot)
+{
+    LOG("Reach forward from joint %p, distance %f", root, distance);
+
+    /* Reaching past effected joint may visit joints not yet flushed */
+    if(root->has_pending)
+        ik_push_down_pending(root);
+
+    float org_x = root->position.x;
+    float org_y = root->position.y;
+
+
+    /* Move root towards target */
+    ik_move_within_dist(&root->position, distance, target_x, target_y);
+
+    /* Parent and grandparent are final, so constrain relative to them */
+    if(root->constrained && root->parent && root->parent->parent)
+        ik_constrain_forward(&root->position, root->parent->position, root->parent->parent->position,
+                             root->min_angle, root->max_angle);
+
+    if(emit_slot >= 0)
+        emit->data[emit_slot] = root->position;
+
+
+    /* Terminate if we've reached leaf */
+    if(root->n_children == 0)
+        return;
+
+
+    /* Reach forward through this child */
+    ik_joint *path_child;
+
+    /* If 'root' has more than 1 child, all but path_child       */
+    /*  must be aligned according to new orientation, provided   */
+    /*  that 'root' has a parent to define this orientation, ie. */
+    /*  'root' is not the root of the whole tree.                */
+    if(root->n_children > 1) {
+
+        LOG("Has %d children", root->n_children);
+        path_child = ik_stack_pop();
+        ik_align_children(root, path_child, org_x, org_y, emit);
+    } else {
+        path_child = root->children[0];
+    }
+
+
+    /* Reserve segment to path child, to be filled once it is placed */
+    int path_slot = -1;
+    if(emit)
+    {
+        ik_vertex_buffer_push(emit, root->position);
+        ik_vertex_buffer_push(emit, path_child->position);
+        path_slot = emit->size - 1;
+    }
+    
+
+    /* Recurse */
+    /* TODO: Use stack ? */
+    ik_reach_forward(
+        path_child,
+        path_child->length,
+        root->position.x,
+        root->position.y,
+        emit,
+        path_slot
+    );
+}
+
+
+
+/*
+ * Performs back and forward reach along precomputed path from
+ *  effected joint (path[0]) to root, aligning side branches at 
+ *  every branch point.
+ */
+static void ik_reach_path(ik_joint **path, int n_path, float target_x, float target_y)
+{
+    /* Reach back */
+    float distance = 0.0f;
+    ik_vec2 root_org = path[n_path - 1]->position;
+
+    for(int k = 0; k < n_path; k++)
+    {
+        ik_joint *joint = path[k];
+        ik_vec2 org = joint->position;
+
+        ik_move_within_dist(&joint->position, distance, target_x, target_y);
+
+        if(k >= 2 && path[k - 2]->constrained)
+            ik_constrain_back(&joint->position, path[k - 1]->position, path[k - 2]->position,
+                              path[k - 2]->min_angle, path[k - 2]->max_angle);
+
+        ik_joint *path_child = k > 0 ? path[k - 1] : NULL;
+        if(joint->n_children > (path_child != NULL))
+            ik_align_children(joint, path_child, org.x, org.y, NULL);
+
+        target_x = joint->position.x;
+        target_y = joint->position.y;
+        distance = joint->length;
+    }
+
+
+    /* Reach forward */
+    distance = 0.0f;
+    target_x = root_org.x;
+    target_y = root_org.y;
+
+    for(int k = n_path - 1; k >= 0; k--)
+    {
+        ik_joint *joint = path[k];
+        ik_vec2 org = joint->position;
+
+        ik_move_within_dist(&joint->position, distance, target_x, target_y);
+
+        if(k <= n_path - 3 && joint->constrained)
+            ik_constrain_forward(&joint->position, path[k + 1]->position, path[k + 2]->position,
+                                 joint->min_angle, joint->max_angle);
+
+        ik_joint *path_child = k > 0 ? path[k - 1] : NULL;
+        if(joint->n_children > (path_child != NULL))
+            ik_align_children(joint, path_child, org.x, org.y, NULL);
+
+        if(path_child)
+        {
+            target_x = joint->position.x;
+            target_y = joint->position.y;
+            distance = path_child->length;
+        }
+    }
+}
+
+
+
+/*
+ * Rotates branch below path[k] around it, by angle with cosine 'c'
+ *  and sine 's' limited by constraint of path[k - 1]. The rotation is
+ *  added to pending transforms of the branch, and applied to
+ *  'effected', which tracks position of the effected joint.
+ * Rotations must be made from the effected joint towards the root, so
+ *  that path[k] has not moved yet.
+ */
+static void ik_rotate_below(ik_joint **path, int n_path, int k, float c, float s, ik_vec2 *effected)
+{
+    ik_joint *child = path[k - 1];
+    ik_vec2 pivot = path[k]->position;
+
+    if(child->constrained && k + 1 < n_path)
+    {
+        float dx = child->position.x - pivot.x, dy = child->position.y - pivot.y;
+        float rx = c * dx - s * dy, ry = s * dx + c * dy;
+
+        ik_clamp_direction(pivot.x - path[k + 1]->position.x, pivot.y - path[k + 1]->position.y,
+                           &rx, &ry, child->min_angle, child->max_angle);
+
+        float dir_len2 = dx * dx + dy * dy;
+        if(dir_len2 == 0.0f)
+            return;
+        c = (dx * rx + dy * ry) / dir_len2;
+        s = (dx * ry - dy * rx) / dir_len2;
+    }
+
+    /* Clamping and rounding change length of (c, s), which would
+     *  otherwise scale the branch on every rotation */
+    float norm2 = c * c + s * s;
+    if(norm2 == 0.0f)
+        return;
+    float scale = IK_RSQRT(norm2);
+    c *= scale;
+    s *= scale;
+
+    ik_transform t;
+    t.c = c;
+    t.s = s;
+    t.tx = pivot.x - (c * pivot.x - s * pivot.y);
+    t.ty = pivot.y - (s * pivot.x + c * pivot.y);
+
+    ik_compose_pending(child, t);
+    ik_apply_transform(effected, t);
+}
+
+
+
+/*
+ * Places joints of up to date path at their segment lengths from their
+ *  parents, moving side branches along. Rotations keep lengths only up
+ *  to rounding, which would otherwise build up over many solves.
+ */
+static void ik_restore_path_lengths(ik_joint **path, int n_path)
+{
+    for(int k = n_path - 2; k >= 0; k--)
+    {
+        ik_joint *joint = path[k];
+        ik_vec2 old = joint->position;
+        ik_snap_to_parent(joint, old.x - joint->parent->position.x, old.y - joint->parent->position.y);
+
+        ik_transform t = { 1.0f, 0.0f, joint->position.x - old.x, joint->position.y - old.y };
+        if(t.tx == 0.0f && t.ty == 0.0f)
+            continue;
+
+        for(int i = 0; i < joint->n_children; i++)
+            if(k == 0 || joint->children[i] != path[k - 1])
+                ik_compose_pending(joint->children[i], t);
+    }
+}
+
+
+
+/*
+ * Performs one pass of cyclic coordinate descent along precomputed
+ *  path. Positions along the path must be up to date. Rotations are
+ *  left pending, so a pass only visits joints of the path.
+ */
+static void ik_ccd_path(ik_joint **path, int n_path, float target_x, float target_y,
+                        ik_vec2 *effected)
+{
+    for(int k = 1; k < n_path; k++)
+    {
+        ik_vec2 pivot = path[k]->position;
+
+        float from_x = effected->x - pivot.x, from_y = effected->y - pivot.y;
+        float to_x = target_x - pivot.x, to_y = target_y - pivot.y;
+        float denom = length(from_x, from_y) * length(to_x, to_y);
+        if(denom == 0.0f)
+            continue;
+
+        /* Sine is taken from the cross product rather than the cosine,
+         *  so that small final corrections are not lost to rounding */
+        ik_rotate_below(path, n_path, k,
+                        (from_x * to_x + from_y * to_y) / denom,
+                        (from_x * to_y - from_y * to_x) / denom,
+                        effected);
+    }
+}
+
+
+
+/*
+ * Performs one damped least squares step along precomputed path,
+ *  rotating every path joint at once by
+ *   dtheta = J^T (J J^T + damping^2 I)^-1 e,
+ *  where e is the error of the effected joint, and column k of the
+ *  Jacobian J is the effected joint relative to path[k], turned by
+ *  90 degrees. With a single planar effector, J J^T is a 2x2 matrix
+ *  accumulated in one pass over the path, so J itself is never stored.
+ */
+static void ik_dls_path(ik_joint **path, int n_path, float target_x, float target_y,
+                        float damping, ik_vec2 *effected)
+{
+    ik_vec2 e = *effected;
+
+    /* J J^T = sum of [ ry^2, -rx ry; -rx ry, rx^2 ] */
+    float a11 = 0.0f, a12 = 0.0f, a22 = 0.0f;
+    for(int k = 1; k < n_path; k++)
+    {
+        float rx = e.x - path[k]->position.x;
+        float ry = e.y - path[k]->position.y;
+        a11 += ry * ry;
+        a12 -= rx * ry;
+        a22 += rx * rx;
+    }
+
+    float lambda2 = damping * damping;
+    a11 += lambda2;
+    a22 += lambda2;
+
+    float det = a11 * a22 - a12 * a12;
+    if(det == 0.0f)
+        return;
+
+    float err_x = target_x - e.x, err_y = target_y - e.y;
+    float f_x = ( a22 * err_x - a12 * err_y) / det;
+    float f_y = (-a12 * err_x + a11 * err_y) / det;
+
+    /* Angles are found from positions before this step, and rotations
+     *  applied towards the root, which matches changing all angles at once */
+    for(int k = 1; k < n_path; k++)
+    {
+        float rx = e.x - path[k]->position.x;
+        float ry = e.y - path[k]->position.y;
+        float dtheta = rx * f_y - ry * f_x;
+
+        ik_rotate_below(path, n_path, k, IK_COS(dtheta), IK_SIN(dtheta), effected);
+    }
+}
+
+
+
+/*
+ * Places path joints according to 'seed', see IK_SEED_STRAIGHT and
+ *  IK_SEED_TWO_BONE. Each joint is placed by rotating it's branch
+ *  around it's parent, going from the root, so side branches follow.
+ */
+static void ik_seed_path(ik_joint **path, int n_path, float target_x, float target_y, int seed)
+{
+    ik_joint *root = path[n_path - 1];
+    if(root->has_pending)
+        ik_push_down_pending(root);
+
+    float total = 0.0f;
+    for(int k = 0; k < n_path - 1; k++)
+        total += path[k]->length;
+
+    float dx = target_x - root->position.x;
+    float dy = target_y - root->position.y;
+    float dist = length(dx, dy);
+    if(dist == 0.0f || total == 0.0f)
+        return;
+    if(seed == IK_SEED_STRAIGHT && dist < total)
+        return;
+    dx /= dist;
+    dy /= dist;
+
+    /* Joints from path[bend] towards the root point along 'first', the rest along 'second' */
+    int bend = 0;
+    ik_vec2 first = { dx, dy }, second = { dx, dy };
+
+    if(seed == IK_SEED_TWO_BONE)
+    {
+        float l1 = 0.0f;
+        for(bend = n_path - 1; bend > 0 && 2.0f * l1 < total; bend--)
+            l1 += path[bend - 1]->length;
+        float l2 = total - l1;
+
+        if(bend > 0 && dist < total)
+        {
+            /* Law of cosines gives angle between target direction and first half */
+            float c = (l1 * l1 + dist * dist - l2 * l2) / (2.0f * l1 * dist);
+            c = c > 1.0f ? 1.0f : c < -1.0f ? -1.0f : c;
+            float s = IK_SQRT(1.0f - c * c);
+
+            float side_x = path[bend]->position.x - root->position.x;
+            float side_y = path[bend]->position.y - root->position.y;
+            if(dx * side_y - dy * side_x < 0.0f)
+                s = -s;
+
+            first.x = c * dx - s * dy;
+            first.y = s * dx + c * dy;
+
+            float bx = root->position.x + l1 * first.x;
+            float by = root->position.y + l1 * first.y;
+            float to_target = length(target_x - bx, target_y - by);
+            if(to_target > 0.0f)
+            {
+                second.x = (target_x - bx) / to_target;
+                second.y = (target_y - by) / to_target;
+            }
+        }
+    }
+
+    for(int k = n_path - 2; k >= 0; k--)
+    {
+        ik_joint *joint = path[k];
+        ik_vec2 pivot = path[k + 1]->position;
+        ik_vec2 dir = k >= bend ? first : second;
+
+        if(joint->has_pending)
+            ik_push_down_pending(joint);
+
+        float ux = joint->position.x - pivot.x;
+        float uy = joint->position.y - pivot.y;
+        float u_len = length(ux, uy);
+        if(u_len == 0.0f)
+            continue;
+
+        ik_transform t;
+        t.c = (ux * dir.x + uy * dir.y) / u_len;
+        t.s = (ux * dir.y - uy * dir.x) / u_len;
+        t.tx = pivot.x - (t.c * pivot.x - t.s * pivot.y);
+        t.ty = pivot.y - (t.s * pivot.x + t.c * pivot.y);
+
+        ik_compose_pending(joint, t);
+        ik_push_down_pending(joint);
+    }
+}
+
+
+
+/*
+ * Adds outcome of one solve to histograms of telemetry sink.
+ */
+static void ik_telemetry_add(ik_telemetry *telemetry, int converged, int iterations,
+                             float residual, long long ns)
+{
+    telemetry->n_solves++;
+    telemetry->n_converged += converged;
+    telemetry->total_iterations += iterations;
+    telemetry->total_ns += ns;
+    if(ns > telemetry->max_ns)
+        telemetry->max_ns = ns;
+    if(residual > telemetry->max_residual)
+        telemetry->max_residual = residual;
+
+    int bucket = 0;
+    for(float limit = 1e-7f; bucket < IK_TELEMETRY_BUCKETS - 1 && residual >= limit; limit *= 10.0f)
+        bucket++;
+    telemetry->residual[bucket]++;
+
+    bucket = iterations < IK_TELEMETRY_BUCKETS - 1 ? iterations : IK_TELEMETRY_BUCKETS - 1;
+    telemetry->iterations[bucket]++;
+
+    bucket = 0;
+    for(long long limit = 256; bucket < IK_TELEMETRY_BUCKETS - 1 && ns >= limit; limit *= 2)
+        bucket++;
+    telemetry->time_ns[bucket]++;
+}
+
+
+
+/*
+ * Iterates solver along precomputed path, used by ik_solve_iterative
+ *  and ik_solve_effector_iterative.
+ */
+static int ik_solve_path(ik_joint **path, int n_path, float target_x, float target_y,
+                         const ik_solve_params *params, ik_solve_result *result)
+{
+    long long start = params->telemetry ? IK_CLOCK_NS() : 0;
+    int iterations = 0;
+    float residual = 0.0f;
+
+    int seeded = params->seed != IK_SEED_PREVIOUS && n_path > 1;
+    if(seeded)
+        ik_seed_path(path, n_path, target_x, target_y, params->seed);
+
+    for(;;)
+    {
+        /* Path must be up to date before reaching along it */
+        if(ik_deferred.n_pending)
+            for(int k = n_path - 1; k >= 0; k--)
+                if(path[k]->has_pending)
+                    ik_push_down_pending(path[k]);
+
+        residual = length(path[0]->position.x - target_x, path[0]->position.y - target_y);
+        if(iterations >= params->max_iterations
+            || (residual <= params->tolerance && !(seeded && iterations == 0)))
+            break;
+
+        if(params->solver == IK_SOLVER_CCD)
+        {
+            ik_vec2 effected = path[0]->position;
+            ik_ccd_path(path, n_path, target_x, target_y, &effected);
+        } else if(params->solver == IK_SOLVER_DLS) {
+            ik_vec2 effected = path[0]->position;
+            ik_dls_path(path, n_path, target_x, target_y, params->damping, &effected);
+        } else {
+            ik_reach_path(path, n_path, target_x, target_y);
+        }
+        iterations++;
+    }
+
+    if(params->solver == IK_SOLVER_CCD || params->solver == IK_SOLVER_DLS)
+        ik_restore_path_lengths(path, n_path);
+
+    /* Seeds, CCD and DLS leave rotations pending, which only deferred mode may keep */
+    if(!ik_deferred.enabled && ik_deferred.n_pending)
+        ik_flush_branch(path[n_path - 1]);
+
+    int converged = residual <= params->tolerance;
+    if(params->telemetry)
+        ik_telemetry_add(params->telemetry, converged, iterations, residual, IK_CLOCK_NS() - start);
+
+    if(result)
+    {
+        result->iterations = iterations;
+        result->residual = residual;
+    }
+    return converged ? IK_OK : IK_ERROR;
+}
+
+
+
+/*
+ * Gets vertex data without reseting buffer, used recursively
+ *  from ik_get_render_data.
+ */
+static void ik_get_render_data_no_reset(ik_joint *root, ik_vertex_buffer *buffer)
+{
+    for(int i = 0; i < root->n_children; i++)
+    {
+        ik_joint *child = root->children[i];
+        ik_vertex_buffer_push(buffer, root->position);
+        ik_vertex_buffer_push(buffer, child->position);
+        ik_get_render_data_no_reset(child, buffer);
+    }
+}
+
+
+/*
+ * Writes render data of branch to 'out' in the order of
+ *  ik_get_render_data, returning pointer past the last vertex.
+ */
+static ik_vec2 *ik_write_render_data(ik_joint *root, ik_vec2 *out)
+{
+    for(int i = 0; i < root->n_children; i++)
+    {
+        ik_joint *child = root->children[i];
+        *out++ = root->position;
+        *out++ = child->position;
+        out = ik_write_render_data(child, out);
+    }
+    return out;
+}
+
+
+
+/*
+ * Restores segment lengths of root's children, where 'org' is
+ *  position of root before it was moved.
+ */
+static void ik_renormalize_children(ik_joint *root, ik_vec2 org)
+{
+    for(int i = 0; i < root->n_children; i++)
+    {
+        ik_joint *child = root->children[i];
+        ik_vec2 child_org = child->position;
+
+        ik_snap_to_parent(child, child_org.x - org.x, child_org.y - org.y);
+        ik_renormalize_children(child, child_org);
+    }
+}
+
+
+
+/*
+ * Finds largest segment length error in branch, used recursively
+ *  from ik_max_length_error.
+ */
+static void ik_max_length_error_no_reset(ik_joint *root, float *max_error)
+{
+    for(int i = 0; i < root->n_children; i++)
+    {
+        ik_joint *child = root->children[i];
+        float error = length(
+            child->position.x - root->position.x,
+            child->position.y - root->position.y) - child->length;
+
+        if(error < 0.0f)
+            error = -error;
+        if(error > *max_error)
+            *max_error = error;
+
+        ik_max_length_error_no_reset(child, max_error);
+    }
+}
+
+
+/*
+ * Writes positions to pose in depth first order, returning pointer
+ *  past last written position.
+ */
+static ik_vec2 *ik_get_pose_no_reset(ik_joint *root, ik_vec2 *pose)
+{
+    *(pose++) = root->position;
+    for(int i = 0; i < root->n_children; i++)
+        pose = ik_get_pose_no_reset(root->children[i], pose);
+    return pose;
+}
+
+
+
+/*
+ * Reads positions from pose in depth first order, returning pointer
+ *  past last read position.
+ */
+static const ik_vec2 *ik_set_pose_no_reset(ik_joint *root, const ik_vec2 *pose)
+{
+    root->position = *(pose++);
+    for(int i = 0; i < root->n_children; i++)
+        pose = ik_set_pose_no_reset(root->children[i], pose);
+    return pose;
+}
+
+
+
+/*
+ * Fills skeleton arrays from branch beginning at 'joint', in depth first 
+ *  order. 'next_index' and 'next_child' are the next free joint index 
+ *  and the next free entry in 'children'. Returns index of 'joint'.
+ */
+static int ik_skeleton_fill(ik_skeleton *skeleton, ik_joint *joint, int parent,
+                            int *next_index, int *next_child)
+{
+    int index = (*next_index)++;
+
+    skeleton->parent[index] = parent;
+    skeleton->length[index] = joint->length;
+    skeleton->min_angle[index] = joint->min_angle;
+    skeleton->max_angle[index] = joint->max_angle;
+    skeleton->constrained[index] = joint->constrained;
+    skeleton->n_children[index] = joint->n_children;
+
+    /* Reserve contiguous range for children before descending */
+    int first_child = *next_child;
+    skeleton->first_child[index] = first_child;
+    *next_child += joint->n_children;
+
+    for(int i = 0; i < joint->n_children; i++)
+        skeleton->children[first_child + i] = 
+            ik_skeleton_fill(skeleton, joint->children[i], index, next_index, next_child);
+
+    skeleton->subtree_size[index] = *next_index - index;
+    return index;
+}
+
+
+
+/*
+ * Aligns all branches of 'joint' except 'path_child' (-1 for none) 
+ *  after 'joint' has been moved from 'org', like ik_align_branch and 
+ *  ik_align_branch_only_translate do for joint trees.
+ */
+static void ik_skeleton_align_children(const ik_skeleton *skeleton, ik_vec2 *pose, int joint,
+                                       int path_child, ik_vec2 org)
+{
+    int parent = skeleton->parent[joint];
+    const int *children = skeleton->children + skeleton->first_child[joint];
+
+    if(parent >= 0)
+    {
+        ik_vec2 from, to, offset;
+
+        from.x = org.x - pose[parent].x;
+        from.y = org.y - pose[parent].y;
+
+        to.x = pose[joint].x - pose[parent].x;
+        to.y = pose[joint].y - pose[parent].y;
+
+        offset.x = to.x - from.x;
+        offset.y = to.y - from.y;
+
+        struct ik_matrix mat = ik_find_matrix(from, to);
+
+        for(int i = 0; i < skeleton->n_children[joint]; i++)
+        {
+            int child = children[i];
+            if(child == path_child)
+                continue;
+
+            /* Branch is contiguous, and parents come before children */
+            int end = child + skeleton->subtree_size[child];
+            for(int j = child; j < end; j++)
+            {
+                ik_transform_point(&pose[j], pose[joint], mat, offset);
+#ifdef IK_RENORMALIZE
+                ik_vec2 *p = &pose[skeleton->parent[j]];
+                ik_place_at_dist(&pose[j], *p, skeleton->length[j], pose[j].x - p->x, pose[j].y - p->y);
+#endif
+            }
+        }
+    } else {
+        float offset_x = pose[joint].x - org.x;
+        float offset_y = pose[joint].y - org.y;
+
+        for(int i = 0; i < skeleton->n_children[joint]; i++)
+        {
+            int child = children[i];
+            if(child == path_child)
+                continue;
+
+            int end = child + skeleton->subtree_size[child];
+            for(int j = child; j < end; j++)
+            {
+                pose[j].x += offset_x;
+                pose[j].y += offset_y;
+            }
+        }
+    }
+}
+
+
+
+/*
+ * Finds path from 'effected' to root in scratch memory, storing it in
+ *  '*path' and returning its length, or 0 if 'effected' is invalid.
+ */
+static int ik_skeleton_find_path(const ik_skeleton *skeleton, int effected, int **path)
+{
+    if(effected < 0 || effected >= skeleton->n_joints)
+        return 0;
+
+    int n_path = 0;
+    for(int joint = effected; joint >= 0; joint = skeleton->parent[joint])
+        n_path++;
+
+    *path = ik_scratch_alloc(sizeof(int) * n_path);
+
+    int k = 0;
+    for(int joint = effected; joint >= 0; joint = skeleton->parent[joint])
+        (*path)[k++] = joint;
+    return n_path;
+}
+
+
+
+/*
+ * Performs back and forward reach along 'path', as found by
+ *  ik_skeleton_find_path.
+ */
+static void ik_skeleton_reach(const ik_skeleton *skeleton, ik_vec2 *pose, const int *path, int n_path,
+                              float target_x, float target_y)
+{
+    /* Reach back */
+    float distance = 0.0f;
+    ik_vec2 root_org = pose[path[n_path - 1]];
+
+    for(int k = 0; k < n_path; k++)
+    {
+        int joint = path[k];
+        ik_vec2 org = pose[joint];
+
+        ik_move_within_dist(&pose[joint], distance, target_x, target_y);
+
+        if(k >= 2 && skeleton->constrained[path[k - 2]])
+            ik_constrain_back(&pose[joint], pose[path[k - 1]], pose[path[k - 2]],
+                              skeleton->min_angle[path[k - 2]], skeleton->max_angle[path[k - 2]]);
+
+        int path_child = k > 0 ? path[k - 1] : -1;
+        if(skeleton->n_children[joint] > (path_child >= 0))
+            ik_skeleton_align_children(skeleton, pose, joint, path_child, org);
+
+        target_x = pose[joint].x;
+        target_y = pose[joint].y;
+        distance = skeleton->length[joint];
+    }
+
+
+    /* Reach forward */
+    distance = 0.0f;
+    target_x = root_org.x;
+    target_y = root_org.y;
+
+    for(int k = n_path - 1; k >= 0; k--)
+    {
+        int joint = path[k];
+        ik_vec2 org = pose[joint];
+
+        ik_move_within_dist(&pose[joint], distance, target_x, target_y);
+
+        if(k <= n_path - 3 && skeleton->constrained[joint])
+            ik_constrain_forward(&pose[joint], pose[path[k + 1]], pose[path[k + 2]],
+                                 skeleton->min_angle[joint], skeleton->max_angle[joint]);
+
+        int path_child = k > 0 ? path[k - 1] : -1;
+        if(skeleton->n_children[joint] > (path_child >= 0))
+            ik_skeleton_align_children(skeleton, pose, joint, path_child, org);
+
+        if(k > 0)
+        {
+            target_x = pose[joint].x;
+            target_y = pose[joint].y;
+            distance = skeleton->length[path_child];
+        }
+    }
+}
+
+
+
+/*
+ * Interpolates poses 'a' and 'b' by 'weights[i]' for joint i, or by
+ *  't' if 'weights' is NULL, preserving segment lengths.
+ * Segment directions are first written to 'out' in reverse order, so 
+ *  that parents are still absolute in 'a' and 'b' if 'out' aliases 
+ *  either, then accumulated in depth first order.
+ */
+static void ik_pose_nlerp_weighted(const ik_skeleton *skeleton, ik_vec2 *out, 
+                                   const ik_vec2 *a, const ik_vec2 *b, 
+                                   float t, const float *weights)
+{
+    const int *parent = skeleton->parent;
+    ik_vec2 origin = { 0.0f, 0.0f };
+
+    for(int i = skeleton->n_joints - 1; i > 0; i--)
+    {
+        float w = weights ? weights[i] : t;
+        float ax = a[i].x - a[parent[i]].x, ay = a[i].y - a[parent[i]].y;
+        float bx = b[i].x - b[parent[i]].x, by = b[i].y - b[parent[i]].y;
+        float dx = ax + w * (bx - ax);
+        float dy = ay + w * (by - ay);
+
+        /* Opposite directions interpolate to zero, keep 'a' instead */
+        out[i].x = ax;
+        out[i].y = ay;
+        ik_place_at_dist(&out[i], origin, skeleton->length[i], dx, dy);
+    }
+
+    float w = weights ? weights[0] : t;
+    out[0].x = a[0].x + w * (b[0].x - a[0].x);
+    out[0].y = a[0].y + w * (b[0].y - a[0].y);
+
+    for(int i = 1; i < skeleton->n_joints; i++)
+    {
+        out[i].x += out[parent[i]].x;
+        out[i].y += out[parent[i]].y;
+    }
+}
+
+
+
+/*
+ * Flag set in 'middle' index of pose buffer when it holds a pose
+ *  that the reader has not yet seen.
+ */
+#define IK_POSE_FRESH 4
+
+
+#ifndef IK_NO_RECORDER
+
+/*
+ * Recorder state, with 'file' set while recording.
+ *
+ * Log begins with "IKR1", the number of joints and the joints in 
+ *  depth first order, each as parent index, length, position and 
+ *  constraint. It is followed by one record per call, beginning with
+ *  call type and path of child indices from root to the joint, and 
+ *  the call arguments. Iterative solves also store solver, seed,
+ *  iteration limit, tolerance and damping. Edits store the new parent
+ *  as the joint, followed by the number of joints and the joints of
+ *  an attached branch, or the child as the joint, followed by the path
+ *  of the new parent when moved within the tree. Edits have no
+ *  arguments, but store zeros to keep records alike.
+ */
+static struct {
+    FILE *file;
+    ik_joint *root;
+} ik_recorder;
+
+#define IK_RECORD_SOLVE           1
+#define IK_RECORD_TRANSLATE       2
+#define IK_RECORD_SOLVE_ITERATIVE 3
+#define IK_RECORD_SOLVE_EFFECTOR  4
+#define IK_RECORD_ATTACH          5
+#define IK_RECORD_DETACH          6
+#define IK_RECORD_REPARENT        7
+
+
+/*
+ * Writes joints of branch in depth first order.
+ */
+static void ik_record_topology(FILE *file, ik_joint *joint, int parent, int *next_index)
+{
+    int index = (*next_index)++;
+    float values[5] = { joint->length, joint->position.x, joint->position.y, 
+                        joint->min_angle, joint->max_angle };
+
+    fwrite(&parent, sizeof(int), 1, file);
+    fwrite(values, sizeof(float), 5, file);
+    fwrite(&joint->constrained, sizeof(int), 1, file);
+
+    for(int i = 0; i < joint->n_children; i++)
+        ik_record_topology(file, joint->children[i], index, next_index);
+}
+
+
+/*
+ * Writes child indices along path from root to 'joint'.
+ */
+static void ik_record_path(ik_joint *joint)
+{
+    if(!joint->parent)
+        return;
+
+    ik_record_path(joint->parent);
+
+    unsigned short i = 0;
+    while(joint->parent->children[i] != joint)
+        i++;
+    fwrite(&i, sizeof(unsigned short), 1, ik_recorder.file);
+}
+
+
+/*
+ * Returns depth of 'joint' in the recorded tree, or -1 if it is outside
+ *  the tree or too deep to record.
+ */
+static int ik_record_depth(ik_joint *joint)
+{
+    int depth = 0;
+    for(; joint->parent; joint = joint->parent)
+        depth++;
+
+    return joint == ik_recorder.root && depth <= 0xffff ? depth : -1;
+}
+
+
+/*
+ * Writes depth and path of joint in the recorded tree.
+ */
+static void ik_record_joint(ik_joint *joint, int depth)
+{
+    unsigned short n = (unsigned short)depth;
+    fwrite(&n, sizeof(n), 1, ik_recorder.file);
+    ik_record_path(joint);
+}
+
+
+/*
+ * Writes record of call on 'joint' with arguments (x, y). Calls on 
+ *  joints outside the recorded tree are ignored.
+ */
+static int ik_record_call(unsigned char type, ik_joint *joint, float x, float y)
+{
+    int depth = ik_record_depth(joint);
+    if(depth < 0)
+        return 0;
+
+    fwrite(&type, 1, 1, ik_recorder.file);
+    ik_record_joint(joint, depth);
+
+    float args[2] = { x, y };
+    fwrite(args, sizeof(float), 2, ik_recorder.file);
+    return 1;
+}
+
+
+
+/*
+ * Records iterative solve, storing parameters after call arguments.
+ */
+static void ik_record_solve_iterative(ik_joint *effected, float x, float y, 
+                                      const ik_solve_params *params)
+{
+    if(!ik_record_call(IK_RECORD_SOLVE_ITERATIVE, effected, x, y))
+        return;
+
+    int ints[3] = { params->solver, params->seed, params->max_iterations };
+    fwrite(ints, sizeof(int), 3, ik_recorder.file);
+    float floats[2] = { params->tolerance, params->damping };
+    fwrite(floats, sizeof(float), 2, ik_recorder.file);
+}
+
+
+/*
+ * Records moving branch of 'child' to 'parent', or detaching it if
+ *  'parent' is NULL, before the edit is made. Branches moved into the
+ *  recorded tree are written in full, as they were not recorded yet.
+ */
+static void ik_record_edit(ik_joint *child, ik_joint *parent)
+{
+    if(child == ik_recorder.root)
+    {
+        /* Later calls on the tree could no longer be told apart */
+        if(parent)
+            ik_record_end();
+        return;
+    }
+
+    int in_tree = ik_record_depth(child) >= 0;
+    int parent_depth = parent ? ik_record_depth(parent) : -1;
+
+    if(in_tree && parent_depth >= 0)
+    {
+        ik_record_call(IK_RECORD_REPARENT, child, 0.0f, 0.0f);
+        ik_record_joint(parent, parent_depth);
+    } else if(in_tree) {
+        ik_record_call(IK_RECORD_DETACH, child, 0.0f, 0.0f);
+    } else if(parent_depth >= 0) {
+        ik_record_call(IK_RECORD_ATTACH, parent, 0.0f, 0.0f);
+
+        ik_flush_transforms(child);
+        int n = ik_count_joints(child), next_index = 0;
+        fwrite(&n, sizeof(int), 1, ik_recorder.file);
+        ik_record_topology(ik_recorder.file, child, -1, &next_index);
+    }
+}
+
+
+/*
+ * Reads joint path of record, returning joint or NULL if path is invalid.
+ */
+static ik_joint *ik_replay_joint(FILE *file, ik_joint *root)
+{
+    unsigned short depth, index;
+    if(fread(&depth, sizeof(depth), 1, file) != 1)
+        return NULL;
+
+    for(int i = 0; i < depth; i++)
+    {
+        if(fread(&index, sizeof(index), 1, file) != 1 || index >= root->n_children)
+            return NULL;
+        root = root->children[index];
+    }
+    return root;
+}
+
+
+/*
+ * Reads number of joints and joints of recorded branch, returning root
+ *  or NULL on malformed input.
+ */
+static ik_joint *ik_replay_branch(FILE *file)
+{
+    int n;
+    if(fread(&n, sizeof(int), 1, file) != 1 || n <= 0)
+        return NULL;
+
+    int *parent = ik_malloc(sizeof(int) * n);
+    int *n_children = ik_malloc(sizeof(int) * n);
+    int *constrained = ik_malloc(sizeof(int) * n);
+    float *values = ik_malloc(sizeof(float) * 5 * n);
+    ik_joint *root = NULL;
+    int ok = 1;
+
+    for(int i = 0; i < n && ok; i++)
+    {
+        n_children[i] = 0;
+        ok = fread(&parent[i], sizeof(int), 1, file) == 1
+            && fread(values + 5 * i, sizeof(float), 5, file) == 5
+            && fread(&constrained[i], sizeof(int), 1, file) == 1
+            && (i == 0 ? parent[i] == -1 : parent[i] >= 0 && parent[i] < i);
+        if(ok && i > 0)
+            n_children[parent[i]]++;
+    }
+
+    if(ok)
+    {
+        ik_joint **joints = ik_malloc(sizeof(ik_joint*) * n);
+
+        for(int i = 0; i < n; i++)
+        {
+            float *v = values + 5 * i;
+            joints[i] = ik_new_joint(v[0], n_children[i]);
+            joints[i]->position.x = v[1];
+            joints[i]->position.y = v[2];
+            joints[i]->min_angle = v[3];
+            joints[i]->max_angle = v[4];
+            joints[i]->constrained = constrained[i];
+            if(i > 0)
+                ik_attach_joint(joints[i], joints[parent[i]]);
+        }
+
+        root = joints[0];
+        ik_free(joints);
+    }
+
+    ik_free(parent);
+    ik_free(n_children);
+    ik_free(constrained);
+    ik_free(values);
+    return root;
+}
+
+
+/*
+ * Reads recorded tree, returning root or NULL on malformed input.
+ */
+static ik_joint *ik_replay_topology(FILE *file)
+{
+    char magic[4];
+    if(fread(magic, 1, 4, file) != 4 
+        || magic[0] != 'I' || magic[1] != 'K' || magic[2] != 'R' || magic[3] != '1')
+        return NULL;
+
+    return ik_replay_branch(file);
+}
+
+#endif /* IK_NO_RECORDER */
+
+
+/*
+ * Allocation holding joints moved by ik_relayout, followed by the 
+ *  joints themselves. Freed once the last of them is freed.
+ */
+struct ik_joint_block {
+    int n_live;
+};
+
+#define IK_JOINT_BLOCK_HEADER \
+    ((sizeof(struct ik_joint_block) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*))
+
+
+
+/*
+ * Frees joint, without it's children.
+ */
+static void ik_free_joint(ik_joint *joint)
+{
+    if(joint->has_pending)
+        ik_deferred.n_pending--;
+    if(joint->children != joint->inline_children)
+        ik_free(joint->children);
+
+    if(!joint->block)
+        ik_free(joint);
+    else if(--joint->block->n_live == 0)
+        ik_free(joint->block);
+}
+
+
+
+/*
+ * Adds 'child' to children of 'parent', which must have capacity left.
+ */
+static void ik_link_child(ik_joint *child, ik_joint *parent)
+{
+    /* Pending transforms of parent must not reach new child */
+    if(ik_deferred.n_pending)
+        ik_flush_path(parent);
+
+    parent->children[parent->n_children++] = child;
+    child->parent = parent;
+    ik_invalidate_subtree_size(parent);
+}
+
+
+
+/*
+ * Removes 'child' from children of it's parent, keeping order of
+ *  remaining children.
+ */
+static void ik_unlink_child(ik_joint *child)
+{
+    ik_joint *parent = child->parent;
+    if(!parent)
+        return;
+
+    /* Positions in branch must not depend on pending transforms of parent */
+    if(ik_deferred.n_pending)
+        ik_flush_path(parent);
+
+    int i = 0;
+    while(parent->children[i] != child)
+        i++;
+    for(; i < parent->n_children - 1; i++)
+        parent->children[i] = parent->children[i + 1];
+    parent->n_children--;
+
+    ik_invalidate_subtree_size(parent);
+    child->parent = NULL;
+}
+
+
+
+/*
+ * Releases pool slots of all joints in branch, and frees them.
+ */
+static void ik_pool_release_branch(ik_joint_pool *pool, ik_joint *root)
+{
+    for(int i = 0; i < root->n_children; i++)
+        if(root->children[i])
+            ik_pool_release_branch(pool, root->children[i]);
+
+    int index = root->handle & IK_HANDLE_INDEX_MASK;
+    pool->joints[index] = NULL;
+    pool->next_free[index] = pool->free_head;
+    pool->free_head = index;
+
+    /* Skip generation 0, so that 0 is never a valid handle */
+    if(++pool->generation[index] > IK_HANDLE_MAX_GENERATION)
+        pool->generation[index] = 1;
+
+    ik_free_joint(root);
+}
+
+
+
+/*
+ * Appends joints of branch to 'order' depth first, visiting the child
+ *  with the largest branch first.
+ */
+static void ik_layout_dfs(ik_joint *root, ik_joint **order, int *n)
+{
+    order[(*n)++] = root;
+
+    int heavy = -1;
+    for(int i = 0; i < root->n_children; i++)
+        if(heavy < 0 || ik_subtree_size(root->children[i]) > ik_subtree_size(root->children[heavy]))
+            heavy = i;
+
+    if(heavy < 0)
+        return;
+
+    ik_layout_dfs(root->children[heavy], order, n);
+    for(int i = 0; i < root->n_children; i++)
+        if(i != heavy)
+            ik_layout_dfs(root->children[i], order, n);
+}
+
+
+
+/*
+ * Returns number of levels in branch.
+ */
+static int ik_branch_height(ik_joint *root)
+{
+    int height = 0;
+    for(int i = 0; i < root->n_children; i++)
+    {
+        int child_height = ik_branch_height(root->children[i]);
+        if(child_height > height)
+            height = child_height;
+    }
+    return height + 1;
+}
+
+
+
+static void ik_layout_veb(ik_joint *root, int height, ik_joint **order, int *n);
+
+/*
+ * Lays out branches beginning 'depth' levels below 'joint', 
+ *  each limited to 'height' levels.
+ */
+static void ik_layout_veb_bottom(ik_joint *joint, int depth, int height, ik_joint **order, int *n)
+{
+    if(depth == 0)
+    {
+        ik_layout_veb(joint, height, order, n);
+        return;
+    }
+
+    for(int i = 0; i < joint->n_children; i++)
+        ik_layout_veb_bottom(joint->children[i], depth - 1, height, order, n);
+}
+
+/*
+ * Appends the first 'height' levels of branch to 'order' in van Emde
+ *  Boas order: the top half of the levels is laid out recursively, 
+ *  followed by each of the branches hanging below it.
+ */
+static void ik_layout_veb(ik_joint *root, int height, ik_joint **order, int *n)
+{
+    if(height == 1)
+    {
+        order[(*n)++] = root;
+        return;
+    }
+
+    int top = height / 2;
+    ik_layout_veb(root, top, order, n);
+    ik_layout_veb_bottom(root, top, height - top, order, n);
+}
+
+
+
+/*
+ * Moves joints of branch into a single block, updating slots of 
+ *  'pool' if not NULL.
+ */
+static ik_joint *ik_relayout_branch(ik_joint_pool *pool, ik_joint *root, int layout)
+{
+    ik_flush_transforms(root);
+
+    int n_joints = ik_subtree_size(root);
+    int n = 0;
+    ik_joint **order = ik_malloc(sizeof(ik_joint*) * n_joints);
+    struct ik_joint_block **old_blocks = ik_malloc(sizeof(struct ik_joint_block*) * n_joints);
+
+    if(layout == IK_LAYOUT_VEB)
+        ik_layout_veb(root, ik_branch_height(root), order, &n);
+    else
+        ik_layout_dfs(root, order, &n);
+
+    unsigned long size = IK_JOINT_BLOCK_HEADER;
+    for(int i = 0; i < n_joints; i++)
+        size += sizeof(ik_joint) + sizeof(ik_joint*) * order[i]->n_children;
+
+    struct ik_joint_block *block = ik_malloc(size);
+    block->n_live = n_joints;
+
+    /* 
+     * Copy joints, leaving children with exactly the capacity in use. 
+     *  The new location of each joint is kept in 'block' of the old 
+     *  one until links are updated.
+     */
+    char *next = (char*)block + IK_JOINT_BLOCK_HEADER;
+    for(int i = 0; i < n_joints; i++)
+    {
+        ik_joint *old = order[i];
+        ik_joint *joint = (ik_joint*)next;
+        next += sizeof(ik_joint) + sizeof(ik_joint*) * old->n_children;
+
+        IK_MEMCPY(joint, old, sizeof(ik_joint));
+        joint->children_cap = old->n_children;
+        joint->children = joint->inline_children;
+        joint->block = block;
+
+        old_blocks[i] = old->block;
+        old->block = (struct ik_joint_block*)joint;
+    }
+
+    for(int i = 0; i < n_joints; i++)
+    {
+        ik_joint *old = order[i];
+        ik_joint *joint = (ik_joint*)old->block;
+
+        if(old != root)
+            joint->parent = (ik_joint*)old->parent->block;
+        for(int c = 0; c < old->n_children; c++)
+            joint->children[c] = (ik_joint*)old->children[c]->block;
+
+        if(pool && old->handle)
+            pool->joints[old->handle & IK_HANDLE_INDEX_MASK] = joint;
+    }
+
+    ik_joint *new_root = (ik_joint*)root->block;
+    if(root->parent)
+    {
+        int i = 0;
+        while(root->parent->children[i] != root)
+            i++;
+        root->parent->children[i] = new_root;
+    }
+
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.root == root)
+        ik_recorder.root = new_root;
+#endif
+
+    for(int i = 0; i < n_joints; i++)
+    {
+        order[i]->block = old_blocks[i];
+        ik_free_joint(order[i]);
+    }
+
+    ik_free(order);
+    ik_free(old_blocks);
+    return new_root;
+}
+
+
+
+/*
+ * Translates branch by vector (dx, dy)
+ */
+void ik_translate_relative(ik_joint *root, float dx, float dy)
+{
+    root->position.x += dx;
+    root->position.y += dy;
+    for(int i = 0; i < root->n_children; i++)
+        ik_translate_relative(root->children[i], dx, dy);
+}
+
+
+
+/**********************************************
+ *            INTERFACE FUNCTIONS             *
+ **********************************************/
+
+void ik_init(void)
+{
+    ik_stack.size = 0;
+}
+
+
+#ifdef IK_ALLOCATOR
+
+ik_allocator ik_set_allocator(const ik_allocator *allocator)
+{
+    ik_allocator previous = ik_thread_allocator;
+    ik_allocator none = { NULL, NULL, NULL };
+    ik_thread_allocator = allocator && allocator->alloc ? *allocator : none;
+    return previous;
+}
+
+#endif
+
+
+void ik_free_scratch(void)
+{
+    while(ik_scratch.top)
+    {
+        struct ik_scratch_block *prev = ik_scratch.top->prev;
+        ik_free(ik_scratch.top);
+        ik_scratch.top = prev;
+    }
+}
+
+ik_joint *ik_new_joint(float length, int n_children)
+{
+    ik_joint *joint = ik_malloc(sizeof(ik_joint) + sizeof(ik_joint*) * n_children);
+
+    joint->position.x = 0.0f;
+    joint->position.y = 0.0f;
+    joint->length = length;
+    joint->min_angle = 0.0f;
+    joint->max_angle = 0.0f;
+    joint->constrained = 0;
+    joint->has_pending = 0;
+    joint->subtree_size = 1;
+    joint->handle = 0;
+    joint->block = NULL;
+    joint->parent = NULL;
+    joint->n_children = 0;
+    joint->children_cap = n_children;
+    joint->children = joint->inline_children;
+    
+    return joint;
+}
+
+
+void ik_delete_branch(ik_joint *root)
+{
+    for(int i = 0; i < root->n_children; i++)
+        if(root->children[i])
+            ik_delete_branch(root->children[i]);
+
+    ik_free_joint(root);
+}
+
+
+int ik_attach_joint(ik_joint *child, ik_joint *parent)
+{
+    if(parent->n_children == parent->children_cap)
+        return IK_ERROR;
+
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_edit(child, parent);
+#endif
+
+    ik_link_child(child, parent);
+    return IK_OK;
+}
+
+
+/*
+ * Makes room for another child of 'parent'.
+ */
+static void ik_reserve_child(ik_joint *parent)
+{
+    if(parent->n_children == parent->children_cap)
+    {
+        int new_cap = parent->children_cap ? parent->children_cap * 2 : 2;
+        ik_joint **children = ik_malloc(sizeof(ik_joint*) * new_cap);
+
+        IK_MEMCPY(children, parent->children, sizeof(ik_joint*) * parent->n_children);
+        if(parent->children != parent->inline_children)
+            ik_free(parent->children);
+
+        parent->children = children;
+        parent->children_cap = new_cap;
+    }
+}
+
+
+void ik_append_joint(ik_joint *child, ik_joint *parent)
+{
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_edit(child, parent);
+#endif
+
+    ik_reserve_child(parent);
+    ik_link_child(child, parent);
+}
+
+
+void ik_detach_joint(ik_joint *child)
+{
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_edit(child, NULL);
+#endif
+
+    ik_unlink_child(child);
+}
+
+
+int ik_reparent_joint(ik_joint *child, ik_joint *parent)
+{
+    for(ik_joint *joint = parent; joint; joint = joint->parent)
+        if(joint == child)
+            return IK_ERROR;
+
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_edit(child, parent);
+#endif
+
+    ik_unlink_child(child);
+    ik_reserve_child(parent);
+    ik_link_child(child, parent);
+    return IK_OK;
+}
+
+
+ik_joint *ik_relayout(ik_joint *root, int layout)
+{
+    return ik_relayout_branch(NULL, root, layout);
+}
+
+
+int ik_set_constraint(ik_joint *joint, float min_angle, float max_angle)
+{
+    if(min_angle > max_angle)
+        return IK_ERROR;
+
+    joint->min_angle = min_angle;
+    joint->max_angle = max_angle;
+    joint->constrained = 1;
+    return IK_OK;
+}
+
+
+void ik_clear_constraint(ik_joint *joint)
+{
+    joint->constrained = 0;
+}
+
+
+ik_joint_pool ik_new_joint_pool(void)
+{
+    ik_joint_pool pool;
+    pool.cap = 16;
+    pool.size = 0;
+    pool.free_head = -1;
+    pool.joints = ik_malloc(sizeof(ik_joint*) * pool.cap);
+    pool.generation = ik_malloc(sizeof(unsigned int) * pool.cap);
+    pool.next_free = ik_malloc(sizeof(int) * pool.cap);
+
+    return pool;
+}
+
+
+void ik_free_joint_pool(ik_joint_pool *pool)
+{
+    for(int i = 0; i < pool->size; i++)
+        if(pool->joints[i])
+            ik_free_joint(pool->joints[i]);
+
+    ik_free(pool->joints);
+    ik_free(pool->generation);
+    ik_free(pool->next_free);
+    pool->size = 0;
+    pool->cap = 0;
+}
+
+
+ik_handle ik_pool_new_joint(ik_joint_pool *pool, float length, int n_children)
+{
+    int index = pool->free_head;
+
+    if(index >= 0)
+    {
+        pool->free_head = pool->next_free[index];
+    } else {
+        if(pool->size > (int)IK_HANDLE_INDEX_MASK)
+            return 0;
+
+        if(pool->size == pool->cap)
+        {
+            int new_cap = pool->cap * 2;
+            ik_joint **joints = ik_malloc(sizeof(ik_joint*) * new_cap);
+            unsigned int *generation = ik_malloc(sizeof(unsigned int) * new_cap);
+            int *next_free = ik_malloc(sizeof(int) * new_cap);
+
+            IK_MEMCPY(joints, pool->joints, sizeof(ik_joint*) * pool->size);
+            IK_MEMCPY(generation, pool->generation, sizeof(unsigned int) * pool->size);
+            IK_MEMCPY(next_free, pool->next_free, sizeof(int) * pool->size);
+            ik_free(pool->joints);
+            ik_free(pool->generation);
+            ik_free(pool->next_free);
+
+            pool->joints = joints;
+            pool->generation = generation;
+            pool->next_free = next_free;
+            pool->cap = new_cap;
+        }
+
+        index = pool->size++;
+        pool->generation[index] = 1;
+    }
+
+    ik_joint *joint = ik_new_joint(length, n_children);
+    joint->handle = (pool->generation[index] << IK_HANDLE_INDEX_BITS) | (unsigned int)index;
+    pool->joints[index] = joint;
+
+    return joint->handle;
+}
+
+
+ik_joint *ik_pool_get(const ik_joint_pool *pool, ik_handle handle)
+{
+    unsigned int index = handle & IK_HANDLE_INDEX_MASK;
+
+    if(index >= (unsigned int)pool->size 
+        || pool->generation[index] != handle >> IK_HANDLE_INDEX_BITS)
+        return NULL;
+
+    return pool->joints[index];
+}
+
+
+int ik_pool_valid(const ik_joint_pool *pool, ik_handle handle)
+{
+    return ik_pool_get(pool, handle) != NULL;
+}
+
+
+int ik_pool_attach(ik_joint_pool *pool, ik_handle child, ik_handle parent)
+{
+    ik_joint *child_joint = ik_pool_get(pool, child);
+    ik_joint *parent_joint = ik_pool_get(pool, parent);
+
+    if(!child_joint || !parent_joint)
+        return IK_ERROR;
+
+    return ik_attach_joint(child_joint, parent_joint);
+}
+
+
+void ik_pool_delete_branch(ik_joint_pool *pool, ik_handle root)
+{
+    ik_joint *joint = ik_pool_get(pool, root);
+    if(!joint)
+        return;
+
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_edit(joint, NULL);
+#endif
+
+    ik_unlink_child(joint);
+    ik_pool_release_branch(pool, joint);
+}
+
+
+int ik_pool_relayout(ik_joint_pool *pool, ik_handle root, int layout)
+{
+    ik_joint *joint = ik_pool_get(pool, root);
+    if(!joint)
+        return IK_ERROR;
+
+    ik_relayout_branch(pool, joint, layout);
+    return IK_OK;
+}
+
+
+void ik_set_deferred_alignment(int enabled)
+{
+    ik_deferred.enabled = enabled;
+}
+
+
+void ik_flush_transforms(ik_joint *root)
+{
+    if(!ik_deferred.n_pending)
+        return;
+
+    ik_flush_path(root);
+    ik_flush_branch(root);
+}
+
+
+#ifdef IK_PARALLEL
+
+int ik_start_parallel_alignment(int n_threads, int min_branch_size)
+{
+    ik_stop_parallel_alignment();
+
+    if(n_threads < 1 || n_threads > IK_PARALLEL_MAX_THREADS)
+        return IK_ERROR;
+
+    ik_workers.n_queues = n_threads + 1;
+    ik_workers.queues = ik_malloc(sizeof(struct ik_task_queue) * ik_workers.n_queues);
+    for(int i = 0; i < ik_workers.n_queues; i++)
+    {
+        pthread_mutex_init(&ik_workers.queues[i].lock, NULL);
+        ik_workers.queues[i].top = 0;
+        ik_workers.queues[i].bottom = 0;
+    }
+
+    pthread_mutex_init(&ik_workers.sleep_lock, NULL);
+    pthread_cond_init(&ik_workers.wake, NULL);
+    ik_workers.min_branch_size = min_branch_size;
+    ik_workers.pending = 0;
+    ik_workers.running = 1;
+    ik_workers.n_threads = 0;
+
+    for(int i = 0; i < n_threads; i++)
+    {
+        if(pthread_create(&ik_workers.threads[i], NULL, ik_worker_main, (void*)(long)(i + 1)) != 0)
+        {
+            ik_stop_parallel_alignment();
+            return IK_ERROR;
+        }
+        ik_workers.n_threads++;
+    }
+
+    return IK_OK;
+}
+
+
+void ik_stop_parallel_alignment(void)
+{
+    if(!ik_workers.queues)
+        return;
+
+    pthread_mutex_lock(&ik_workers.sleep_lock);
+    IK_ATOMIC_EXCHANGE(&ik_workers.running, 0);
+    pthread_cond_broadcast(&ik_workers.wake);
+    pthread_mutex_unlock(&ik_workers.sleep_lock);
+
+    for(int i = 0; i < ik_workers.n_threads; i++)
+        pthread_join(ik_workers.threads[i], NULL);
+
+    for(int i = 0; i < ik_workers.n_queues; i++)
+        pthread_mutex_destroy(&ik_workers.queues[i].lock);
+    pthread_mutex_destroy(&ik_workers.sleep_lock);
+    pthread_cond_destroy(&ik_workers.wake);
+
+    ik_free(ik_workers.queues);
+    ik_workers.queues = NULL;
+    ik_workers.n_threads = 0;
+}
+
+#endif /* IK_PARALLEL */
+
+
+void ik_translate(ik_joint *root, float x, float y)
+{
+    ik_flush_transforms(root);
+
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_call(IK_RECORD_TRANSLATE, root, x, y);
+#endif
+
+    float dx = x - root->position.x;
+    float dy = y - root->position.y;
+    ik_translate_relative(root, dx, dy);
+}
+
+
+int ik_solve(ik_joint *effected, float target_x, float target_y)
+{
+    return ik_solve_render(effected, target_x, target_y, NULL);
+}
+
+
+int ik_solve_render(ik_joint *effected, float target_x, float target_y, ik_vertex_buffer *buffer)
+{
+    LOG("%s", "\n *** SOLVE BEGIN ***\n");
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_call(IK_RECORD_SOLVE, effected, target_x, target_y);
+#endif
+
+    /* Path must be up to date before reaching along it */
+    if(ik_deferred.n_pending)
+        ik_flush_path(effected);
+
+    unsigned long mark = ik_scratch_mark();
+    ik_stack_begin();
+
+    ik_joint *root;
+    float root_org_x, root_org_y;
+
+    ik_reach_back(
+        effected, 
+        NULL,
+        NULL,
+        target_x, 
+        target_y, 
+        0.0f, 
+        &root, 
+        &root_org_x, 
+        &root_org_y
+    );
+
+    if(buffer)
+        ik_vertex_buffer_reset(buffer);
+
+    ik_reach_forward(
+        root, 
+        0.0f, 
+        root_org_x, 
+        root_org_y,
+        buffer,
+        -1
+    );
+
+    ik_scratch_release(mark);
+    LOG("%s", "\n *** SOLVE END ***\n");
+    return 1;
+}
+
+
+ik_effector *ik_new_effector(ik_joint *effected)
+{
+    int n_path = 0;
+    for(ik_joint *joint = effected; joint; joint = joint->parent)
+        n_path++;
+
+    ik_effector *effector = ik_malloc(sizeof(ik_effector) + sizeof(ik_joint*) * n_path);
+    effector->n_path = n_path;
+    effector->path = (ik_joint**)(effector + 1);
+
+    int k = 0;
+    for(ik_joint *joint = effected; joint; joint = joint->parent)
+        effector->path[k++] = joint;
+
+    return effector;
+}
+
+
+void ik_delete_effector(ik_effector *effector)
+{
+    ik_free(effector);
+}
+
+
+int ik_solve_effector(ik_effector *effector, float target_x, float target_y)
+{
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_call(IK_RECORD_SOLVE_EFFECTOR, effector->path[0], target_x, target_y);
+#endif
+
+    if(ik_deferred.n_pending)
+        for(int k = effector->n_path - 1; k >= 0; k--)
+            if(effector->path[k]->has_pending)
+                ik_push_down_pending(effector->path[k]);
+
+    ik_reach_path(effector->path, effector->n_path, target_x, target_y);
+    return IK_OK;
+}
+
+
+ik_solve_params ik_default_solve_params(void)
+{
+    ik_solve_params params;
+    params.solver = IK_SOLVER_FABRIK;
+    params.seed = IK_SEED_PREVIOUS;
+    params.max_iterations = 10;
+    params.tolerance = 0.001f;
+    params.damping = 0.1f;
+    params.telemetry = NULL;
+
+    return params;
+}
+
+
+int ik_solve_iterative(ik_joint *effected, float target_x, float target_y,
+                       const ik_solve_params *params, ik_solve_result *result)
+{
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_solve_iterative(effected, target_x, target_y, params);
+#endif
+
+    unsigned long mark = ik_scratch_mark();
+
+    int n_path = 0;
+    for(ik_joint *joint = effected; joint; joint = joint->parent)
+        n_path++;
+
+    ik_joint **path = ik_scratch_alloc(sizeof(ik_joint*) * n_path);
+    int k = 0;
+    for(ik_joint *joint = effected; joint; joint = joint->parent)
+        path[k++] = joint;
+
+    int status = ik_solve_path(path, n_path, target_x, target_y, params, result);
+    ik_scratch_release(mark);
+
+    return status;
+}
+
+
+int ik_solve_effector_iterative(ik_effector *effector, float target_x, float target_y,
+                                const ik_solve_params *params, ik_solve_result *result)
+{
+#ifndef IK_NO_RECORDER
+    if(ik_recorder.file)
+        ik_record_solve_iterative(effector->path[0], target_x, target_y, params);
+#endif
+
+    return ik_solve_path(effector->path, effector->n_path, target_x, target_y, params, result);
+}
+
+
+void ik_renormalize(ik_joint *root)
+{
+    ik_flush_transforms(root);
+    ik_renormalize_children(root, root->position);
+}
+
+
+float ik_max_length_error(ik_joint *root)
+{
+    ik_flush_transforms(root);
+    float max_error = 0.0f;
+    ik_max_length_error_no_reset(root, &max_error);
+    return max_error;
+}
+
+
+void ik_get_render_data(ik_joint *root, ik_vertex_buffer *buffer)
+{
+    ik_flush_transforms(root);
+    ik_vertex_buffer_reset(buffer);
+    ik_get_render_data_no_reset(root, buffer);
+}
+
+
+int ik_render_to_pool(ik_joint *root, ik_render_pool *pool)
+{
+    /* One segment ends at every joint but the root */
+    int first = ik_render_pool_reserve(pool, 2 * (ik_subtree_size(root) - 1));
+    if(first >= 0)
+        ik_write_render_data(root, pool->data + first);
+    return first;
+}
+
+
+#ifndef IK_NO_RECORDER
+
+int ik_record_begin(ik_joint *root, const char *path)
+{
+    ik_record_end();
+
+    FILE *file = fopen(path, "wb");
+    if(!file)
+        return IK_ERROR;
+
+    ik_flush_transforms(root);
+
+    int n = ik_count_joints(root), next_index = 0;
+    fwrite("IKR1", 1, 4, file);
+    fwrite(&n, sizeof(int), 1, file);
+    ik_record_topology(file, root, -1, &next_index);
+
+    ik_recorder.file = file;
+    ik_recorder.root = root;
+    return IK_OK;
+}
+
+
+void ik_record_end(void)
+{
+    if(!ik_recorder.file)
+        return;
+
+    fclose(ik_recorder.file);
+    ik_recorder.file = NULL;
+    ik_recorder.root = NULL;
+}
+
+
+int ik_replay(const char *path, ik_replay_stats *stats)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return IK_ERROR;
+
+    ik_joint *root = ik_replay_topology(file);
+    if(!root)
+    {
+        fclose(file);
+        return IK_ERROR;
+    }
+
+    ik_replay_stats result = { 0, 0, 0, 0 };
+    unsigned char type;
+    int ok = 1;
+
+    while(ok && fread(&type, 1, 1, file) == 1)
+    {
+        float args[2];
+        ik_joint *joint = ik_replay_joint(file, root);
+
+        ok = joint && fread(args, sizeof(float), 2, file) == 2
+            && type >= IK_RECORD_SOLVE && type <= IK_RECORD_REPARENT;
+
+        ik_solve_params params;
+        if(ok && type == IK_RECORD_SOLVE_ITERATIVE)
+        {
+            int ints[3];
+            float floats[2];
+            ok = fread(ints, sizeof(int), 3, file) == 3
+                && fread(floats, sizeof(float), 2, file) == 2;
+            params.solver = ints[0];
+            params.seed = ints[1];
+            params.max_iterations = ints[2];
+            params.tolerance = floats[0];
+            params.damping = floats[1];
+            params.telemetry = NULL;
+        }
+        if(!ok)
+            break;
+
+        /* Edits are applied untimed, so that stats only cover solving */
+        if(type == IK_RECORD_ATTACH)
+        {
+            ik_joint *branch = ik_replay_branch(file);
+            ok = branch != NULL;
+            if(ok)
+                ik_append_joint(branch, joint);
+            continue;
+        }
+        if(type == IK_RECORD_DETACH)
+        {
+            ok = joint != root;
+            if(ok)
+            {
+                ik_detach_joint(joint);
+                ik_delete_branch(joint);
+            }
+            continue;
+        }
+        if(type == IK_RECORD_REPARENT)
+        {
+            ik_joint *parent = ik_replay_joint(file, root);
+            ok = parent && joint != root && ik_reparent_joint(joint, parent) == IK_OK;
+            continue;
+        }
+
+        /* Effector is created outside the timed call, as in the recorded session */
+        ik_effector *effector = type == IK_RECORD_SOLVE_EFFECTOR ? ik_new_effector(joint) : NULL;
+
+        long long start = IK_CLOCK_NS();
+        if(type == IK_RECORD_SOLVE)
+            ik_solve(joint, args[0], args[1]);
+        else if(type == IK_RECORD_SOLVE_ITERATIVE)
+            ik_solve_iterative(joint, args[0], args[1], &params, NULL);
+        else if(type == IK_RECORD_SOLVE_EFFECTOR)
+            ik_solve_effector(effector, args[0], args[1]);
+        else
+            ik_translate(joint, args[0], args[1]);
+        long long elapsed = IK_CLOCK_NS() - start;
+
+        if(effector)
+            ik_delete_effector(effector);
+
+        result.total_ns += elapsed;
+        if(type != IK_RECORD_TRANSLATE)
+        {
+            result.n_solves++;
+            if(elapsed > result.max_solve_ns)
+                result.max_solve_ns = elapsed;
+        } else {
+            result.n_translates++;
+        }
+    }
+
+    fclose(file);
+    ik_delete_branch(root);
+
+    if(stats)
+        *stats = result;
+    return ok ? IK_OK : IK_ERROR;
+}
+
+#endif /* IK_NO_RECORDER */
+
+
+void ik_reset_telemetry(ik_telemetry *telemetry)
+{
+    ik_telemetry empty = { 0 };
+    *telemetry = empty;
+}
+
+
+#ifndef IK_NO_STDIO
+
+int ik_dump_telemetry(const ik_telemetry *telemetry, const char *label, const char *path)
+{
+    FILE *file = fopen(path, "a");
+    if(!file)
+        return IK_ERROR;
+
+    long long n = telemetry->n_solves;
+    fprintf(file, "%s\n", label);
+    fprintf(file, "solves %lld converged %lld\n", n, telemetry->n_converged);
+    fprintf(file, "mean iterations %g mean ns %g max ns %lld max residual %g\n",
+            n ? (double)telemetry->total_iterations / n : 0.0,
+            n ? (double)telemetry->total_ns / n : 0.0,
+            telemetry->max_ns, telemetry->max_residual);
+
+    fprintf(file, "%-12s %10s  %-12s %10s  %-12s %10s\n",
+            "residual <", "count", "iterations", "count", "ns <", "count");
+
+    for(int i = 0; i < IK_TELEMETRY_BUCKETS; i++)
+    {
+        char residual_limit[16], iterations[16], ns_limit[16];
+        int last = i == IK_TELEMETRY_BUCKETS - 1;
+
+        if(last)
+            snprintf(residual_limit, sizeof(residual_limit), "inf");
+        else
+            snprintf(residual_limit, sizeof(residual_limit), "1e%d", i - 7);
+        snprintf(iterations, sizeof(iterations), last ? "%d+" : "%d", i);
+        if(last)
+            snprintf(ns_limit, sizeof(ns_limit), "inf");
+        else
+            snprintf(ns_limit, sizeof(ns_limit), "%lld", 256LL << i);
+
+        fprintf(file, "%-12s %10lld  %-12s %10lld  %-12s %10lld\n",
+                residual_limit, telemetry->residual[i],
+                iterations, telemetry->iterations[i],
+                ns_limit, telemetry->time_ns[i]);
+    }
+    fprintf(file, "\n");
+
+    int ok = !ferror(file);
+    fclose(file);
+    return ok ? IK_OK : IK_ERROR;
+}
+
+#endif /* IK_NO_STDIO */
+
+
+ik_vertex_buffer ik_new_vertex_buffer(void)
+{
+    ik_vertex_buffer buffer;
+    buffer.cap = 10;
+    buffer.size = 0;
+    buffer.data = ik_malloc(sizeof(ik_vec2) * buffer.cap);
+
+    return buffer;
+}
+
+
+void ik_free_vertex_buffer(ik_vertex_buffer *buffer)
+{
+    ik_free(buffer->data);
+    buffer->data = NULL;
+    buffer->cap = 0;
+    buffer->size = 0;
+}
+
+
+ik_render_pool ik_new_render_pool(int cap)
+{
+    ik_render_pool pool;
+    pool.cap = cap;
+    pool.size = 0;
+    pool.data = ik_malloc(sizeof(ik_vec2) * cap);
+
+    return pool;
+}
+
+
+void ik_free_render_pool(ik_render_pool *pool)
+{
+    ik_free(pool->data);
+    pool->cap = 0;
+    pool->size = 0;
+}
+
+
+void ik_render_pool_reset(ik_render_pool *pool)
+{
+    pool->size = 0;
+}
+
+
+int ik_render_pool_reserve(ik_render_pool *pool, int n_vertices)
+{
+    /* Compare and swap rather than add, so a failed reservation
+     *  leaves no gap for reservations that still fit */
+    int first = IK_ATOMIC_LOAD(&pool->size);
+    do {
+        if(n_vertices > pool->cap - first)
+            return -1;
+    } while(!IK_ATOMIC_COMPARE_EXCHANGE(&pool->size, &first, first + n_vertices));
+
+    return first;
+}
+
+
+int ik_count_joints(ik_joint *root)
+{
+    int count = 1;
+    for(int i = 0; i < root->n_children; i++)
+        count += ik_count_joints(root->children[i]);
+    return count;
+}
+
+
+void ik_get_pose(ik_joint *root, ik_vec2 *pose)
+{
+    ik_flush_transforms(root);
+    ik_get_pose_no_reset(root, pose);
+}
+
+
+void ik_set_pose(ik_joint *root, const ik_vec2 *pose)
+{
+    /* Pending transforms would otherwise be applied to new positions */
+    ik_flush_transforms(root);
+    ik_set_pose_no_reset(root, pose);
+}
+
+
+/*
+ * Finds depth first index of joint, used recursively from ik_joint_index.
+ */
+static int ik_joint_index_no_reset(ik_joint *root, ik_joint *joint, int *index)
+{
+    if(root == joint)
+        return 1;
+
+    for(int i = 0; i < root->n_children; i++)
+    {
+        (*index)++;
+        if(ik_joint_index_no_reset(root->children[i], joint, index))
+            return 1;
+    }
+    return 0;
+}
+
+
+int ik_joint_index(ik_joint *root, ik_joint *joint)
+{
+    int index = 0;
+    return ik_joint_index_no_reset(root, joint, &index) ? index : -1;
+}
+
+
+ik_skeleton *ik_new_skeleton(ik_joint *root)
+{
+    int n = ik_count_joints(root);
+
+    /* Place all arrays in the same allocation as the struct */
+    ik_skeleton *skeleton = ik_malloc(sizeof(ik_skeleton) + n * (6 * sizeof(int) + 3 * sizeof(float)));
+    int *ints = (int*)(skeleton + 1);
+    float *floats = (float*)(ints + 6 * n);
+
+    skeleton->n_joints = n;
+    skeleton->parent       = ints + 0 * n;
+    skeleton->n_children   = ints + 1 * n;
+    skeleton->first_child  = ints + 2 * n;
+    skeleton->children     = ints + 3 * n;
+    skeleton->subtree_size = ints + 4 * n;
+    skeleton->constrained  = ints + 5 * n;
+    skeleton->length       = floats + 0 * n;
+    skeleton->min_angle    = floats + 1 * n;
+    skeleton->max_angle    = floats + 2 * n;
+
+    int next_index = 0, next_child = 0;
+    ik_skeleton_fill(skeleton, root, -1, &next_index, &next_child);
+
+    return skeleton;
+}
+
+
+void ik_delete_skeleton(ik_skeleton *skeleton)
+{
+    ik_free(skeleton);
+}
+
+
+ik_skeleton_lod *ik_new_skeleton_lod(ik_joint *root, const ik_lod_params *params,
+                                     const int *keep, int n_keep)
+{
+    ik_skeleton *full = ik_new_skeleton(root);
+    int n = full->n_joints;
+    const int *parent = full->parent;
+
+    unsigned long mark = ik_scratch_mark();
+    ik_vec2 *pose = ik_scratch_alloc(sizeof(ik_vec2) * n);
+    int *pinned = ik_scratch_alloc(sizeof(int) * n);       /* joint must be kept */
+    int *forced = ik_scratch_alloc(sizeof(int) * n);       /* branch holds a pinned joint */
+    float *reach = ik_scratch_alloc(sizeof(float) * n);    /* longest path down from parent */
+    float *bend_sum = ik_scratch_alloc(sizeof(float) * n); /* bends merged since last kept joint */
+    float *length_sum = ik_scratch_alloc(sizeof(float) * n);
+    int *state = ik_scratch_alloc(sizeof(int) * n);
+    int *kept_child = ik_scratch_alloc(sizeof(int) * n);
+    ik_joint **lod_joints = ik_scratch_alloc(sizeof(ik_joint*) * n);
+    ik_get_pose(root, pose);
+
+    enum { KEPT, MERGED, DROPPED };
+
+    for(int i = 0; i < n; i++)
+    {
+        pinned[i] = i == 0;
+        reach[i] = 0.0f;
+    }
+    for(int k = 0; k < n_keep; k++)
+        if(keep[k] >= 0 && keep[k] < n)
+            pinned[keep[k]] = 1;
+    for(int i = 1; i < n; i++)
+        if(full->constrained[i])
+            pinned[i] = pinned[parent[i]] = 1;
+    for(int i = 0; i < n; i++)
+        forced[i] = pinned[i];
+
+    /* Children come after parents, so fold branches into parents in reverse */
+    for(int i = n - 1; i > 0; i--)
+    {
+        reach[i] += full->length[i];
+        forced[parent[i]] |= forced[i];
+        if(reach[i] > reach[parent[i]])
+            reach[parent[i]] = reach[i];
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        state[i] = KEPT;
+        kept_child[i] = -1;
+        if(i == 0)
+            continue;
+
+        int p = parent[i];
+        if(state[p] == DROPPED
+            || (full->n_children[p] > 1 && !forced[i] && reach[i] < params->min_branch_length))
+            state[i] = DROPPED;
+    }
+
+    /* Single remaining child of every joint, or -2 if there are several */
+    for(int i = n - 1; i > 0; i--)
+        if(state[i] != DROPPED)
+            kept_child[parent[i]] = kept_child[parent[i]] == -1 ? i : -2;
+
+    /* Parents are decided first, so runs of merged joints accumulate downwards */
+    for(int i = 1; i < n; i++)
+    {
+        int c = kept_child[i];
+        if(state[i] == DROPPED || pinned[i] || c < 0)
+            continue;
+
+        float ax = pose[i].x - pose[parent[i]].x, ay = pose[i].y - pose[parent[i]].y;
+        float bx = pose[c].x - pose[i].x, by = pose[c].y - pose[i].y;
+        float bend = IK_ATAN2(ax * by - ay * bx, ax * bx + ay * by);
+        if(bend < 0.0f)
+            bend = -bend;
+
+        bend_sum[i] = bend;
+        length_sum[i] = full->length[i];
+        if(state[parent[i]] == MERGED)
+        {
+            bend_sum[i] += bend_sum[parent[i]];
+            length_sum[i] += length_sum[parent[i]];
+        }
+
+        if(bend_sum[i] < params->max_bend || length_sum[i] < params->min_length)
+            state[i] = MERGED;
+    }
+
+    /* Place all arrays in the same allocation as the struct */
+    ik_skeleton_lod *lod = ik_malloc(sizeof(ik_skeleton_lod) + n * (4 * sizeof(int) + sizeof(ik_vec2)));
+    lod->n_full = n;
+    lod->coord     = (ik_vec2*)(lod + 1);
+    lod->lod_index = (int*)(lod->coord + n);
+    lod->base      = lod->lod_index + 1 * n;
+    lod->from      = lod->lod_index + 2 * n;
+    lod->to        = lod->lod_index + 3 * n;
+
+    /* Build reduced tree from kept joints, which keep their depth first order */
+    int n_lod = 0;
+    for(int i = 0; i < n; i++)
+    {
+        lod->lod_index[i] = -1;
+        if(state[i] != KEPT)
+            continue;
+
+        int p = i ? parent[i] : -1;
+        while(p > 0 && state[p] != KEPT)
+            p = parent[p];
+
+        int n_children = 0;
+        for(int c = 0; c < full->n_children[i]; c++)
+            n_children += state[full->children[full->first_child[i] + c]] != DROPPED;
+
+        float length = p == (i ? parent[i] : -1) ? full->length[i] :
+            IK_SQRT((pose[i].x - pose[p].x) * (pose[i].x - pose[p].x)
+                  + (pose[i].y - pose[p].y) * (pose[i].y - pose[p].y));
+
+        ik_joint *joint = ik_new_joint(length, n_children);
+        joint->position = pose[i];
+        if(full->constrained[i])
+            ik_set_constraint(joint, full->min_angle[i], full->max_angle[i]);
+        if(p >= 0)
+            ik_attach_joint(joint, lod_joints[p]);
+
+        lod_joints[i] = joint;
+        lod->lod_index[i] = n_lod++;
+    }
+
+    lod->skeleton = ik_new_skeleton(lod_joints[0]);
+    ik_delete_branch(lod_joints[0]);
+
+    for(int i = 0; i < n; i++)
+    {
+        if(state[i] == KEPT)
+        {
+            lod->base[i] = lod->from[i] = lod->to[i] = i;
+            lod->coord[i].x = lod->coord[i].y = 0.0f;
+            continue;
+        }
+
+        if(state[i] == MERGED)
+        {
+            /* Interpolate along segment between nearest kept joints */
+            int a = parent[i];
+            while(state[a] != KEPT)
+                a = parent[a];
+            int b = kept_child[i];
+            while(state[b] != KEPT)
+                b = kept_child[b];
+
+            lod->base[i] = lod->from[i] = a;
+            lod->to[i] = b;
+        } else {
+            /* Follow segment ending at parent rigidly */
+            lod->base[i] = lod->to[i] = parent[i];
+            lod->from[i] = parent[parent[i]];
+        }
 
-    /* If reached root, save original position */
-    if(!effected->parent)
-    {
-        LOG("%s", "Is root");
-        *root = effected;
-        *root_org_x = org_x;
-        *root_org_y = org_y;
+        ik_vec2 r = { pose[i].x - pose[lod->base[i]].x, pose[i].y - pose[lod->base[i]].y };
+        ik_vec2 d = { 1.0f, 0.0f };
+        if(lod->from[i] >= 0)
+        {
+            d.x = pose[lod->to[i]].x - pose[lod->from[i]].x;
+            d.y = pose[lod->to[i]].y - pose[lod->from[i]].y;
+        }
+
+        float length2 = d.x * d.x + d.y * d.y;
+        if(length2 == 0.0f)
+        {
+            lod->from[i] = -1;
+            d.x = 1.0f;
+            d.y = 0.0f;
+            length2 = 1.0f;
+        }
+        lod->coord[i].x = (r.x * d.x + r.y * d.y) / length2;
+        lod->coord[i].y = (r.y * d.x - r.x * d.y) / length2;
     }
 
+    ik_scratch_release(mark);
+    ik_delete_skeleton(full);
+    return lod;
+}
 
-    /* Move effected towards target */
-    ik_move_within_dist(effected, distance, target_x, target_y);
 
-    /* If effected joints have more than one child, the other */
-    /*  children's branches must be aligned according to new  */
-    /*  orientation.                                          */
-    if(effected->n_children > 1) {
+void ik_delete_skeleton_lod(ik_skeleton_lod *lod)
+{
+    ik_delete_skeleton(lod->skeleton);
+    ik_free(lod);
+}
 
-        LOG("Has %d children", effected->n_children);
-        ik_joint *path_child = ik_stack_top();
 
-        if(effected->parent)
-        {
-            LOG("%s", "Aligning child branches");
-            ik_vec2 from, to;
+void ik_lod_reduce_pose(const ik_skeleton_lod *lod, const ik_vec2 *full_pose, ik_vec2 *lod_pose)
+{
+    for(int i = 0; i < lod->n_full; i++)
+        if(lod->lod_index[i] >= 0)
+            lod_pose[lod->lod_index[i]] = full_pose[i];
+}
 
-            from.x = org_x - effected->parent->position.x;
-            from.y = org_y - effected->parent->position.y;
 
-            to.x = effected->position.x - effected->parent->position.x;
-            to.y = effected->position.y - effected->parent->position.y;
-            
-            for(int i = 0; i < effected->n_children; i++)
-            {
-                ik_joint *child = effected->children[i];
+void ik_lod_expand_pose(const ik_skeleton_lod *lod, const ik_vec2 *lod_pose, ik_vec2 *full_pose)
+{
+    /* Kept joints first, as merged joints depend on kept descendants */
+    for(int i = 0; i < lod->n_full; i++)
+        if(lod->lod_index[i] >= 0)
+            full_pose[i] = lod_pose[lod->lod_index[i]];
 
-                if(child != path_child)
-                    ik_align_branch(child, from, to);
-            }
-        } else {
-            /* Root of whole tree -> no parent to define orientation */
-            /*  -> only translate                                    */
-            for(int i = 0; i < effected->n_children; i++)
-            {
-                LOG("%s", "Translating child branches");
-                ik_joint *child = effected->children[i];
-
-                if(child != path_child)
-                    ik_align_branch_only_translate(
-                        child, 
-                        effected->position.x - org_x, 
-                        effected->position.y - org_y);
-            }
+    /* Other joints only depend on kept joints and their ancestors */
+    for(int i = 0; i < lod->n_full; i++)
+    {
+        if(lod->lod_index[i] >= 0)
+            continue;
+
+        ik_vec2 d = { 1.0f, 0.0f };
+        if(lod->from[i] >= 0)
+        {
+            d.x = full_pose[lod->to[i]].x - full_pose[lod->from[i]].x;
+            d.y = full_pose[lod->to[i]].y - full_pose[lod->from[i]].y;
         }
+
+        ik_vec2 base = full_pose[lod->base[i]];
+        ik_vec2 c = lod->coord[i];
+        full_pose[i].x = base.x + c.x * d.x - c.y * d.y;
+        full_pose[i].y = base.y + c.x * d.y + c.y * d.x;
     }
-    
+}
 
 
-    /* Terminate if we've reached root */
-    if(!effected->parent)
-        return;
+int ik_skeleton_solve(const ik_skeleton *skeleton, ik_vec2 *pose, int effected, 
+                      float target_x, float target_y)
+{
+    unsigned long mark = ik_scratch_mark();
 
+    int *path;
+    int n_path = ik_skeleton_find_path(skeleton, effected, &path);
+    if(!n_path)
+        return IK_ERROR;
 
-    /* If 'effected' has siblings, push 'effected' to stack     */
-    /*  so that we know which path to take during forward reach */
-    if(effected->parent->n_children > 1) {
-        LOG("%s", "Push joint to path");
-        ik_stack_push(effected);
+    ik_skeleton_reach(skeleton, pose, path, n_path, target_x, target_y);
+    ik_scratch_release(mark);
+    return IK_OK;
+}
+
+
+int ik_skeleton_solve_trajectory(const ik_skeleton *skeleton, ik_vec2 *pose, int effected,
+                                 const ik_vec2 *targets, int n_targets, ik_vec2 *poses)
+{
+    unsigned long mark = ik_scratch_mark();
+
+    int *path;
+    int n_path = ik_skeleton_find_path(skeleton, effected, &path);
+    if(!n_path)
+        return IK_ERROR;
+
+    int n = skeleton->n_joints;
+    for(int step = 0; step < n_targets; step++)
+    {
+        ik_skeleton_reach(skeleton, pose, path, n_path, targets[step].x, targets[step].y);
+        if(poses)
+            IK_MEMCPY(poses + step * n, pose, sizeof(ik_vec2) * n);
     }
 
-    /* Recurse */
-    /* TODO: Use stack ? */
-    ik_reach_back(
-        effected->parent, 
-        effected->position.x,
-        effected->position.y,
-        effected->length,
-        root, root_org_x, root_org_y);
+    ik_scratch_release(mark);
+    return IK_OK;
 }
 
 
-
-static void ik_reach_forward(ik_joint *root, float distance, float target_x, float target_y)
+int ik_skeleton_solve_trajectory_stream(const ik_skeleton *skeleton, ik_vec2 *pose, int effected,
+                                        const ik_vec2 *targets, int n_targets,
+                                        ik_pose_callback callback, void *user)
 {
-    LOG("Reach forward from joint %p, distance %f", root, distance);
-    float org_x = root->position.x;
-    float org_y = root->position.y;
+    unsigned long mark = ik_scratch_mark();
 
+    int *path;
+    int n_path = ik_skeleton_find_path(skeleton, effected, &path);
+    if(!n_path)
+        return IK_ERROR;
 
-    /* Move root towards target */
-    ik_move_within_dist(root, distance, target_x, target_y);
+    /* Callback may solve too, using scratch memory above the path */
+    for(int step = 0; step < n_targets; step++)
+    {
+        ik_skeleton_reach(skeleton, pose, path, n_path, targets[step].x, targets[step].y);
+        callback(user, step, pose, skeleton->n_joints);
+    }
 
+    ik_scratch_release(mark);
+    return IK_OK;
+}
 
-    /* Terminate if we've reached leaf */
-    if(root->n_children == 0)
-        return;
 
+/*
+ * Interleaves zeros with the low 16 bits of 'x'.
+ */
+static inline uint32_t ik_spread_bits(uint32_t x)
+{
+    x &= 0xffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
 
-    /* Reach forward through this child */
-    ik_joint *path_child;
 
-    /* If 'root' has more than 1 child, all but path_child       */
-    /*  must be aligned according to new orientation, provided   */
-    /*  that 'root' has a parent to define this orientation, ie. */
-    /*  'root' is not the root of the whole tree.                */
-    if(root->n_children > 1) {
 
-        LOG("Has %d children", root->n_children);
-        path_child = ik_stack_pop();
+/*
+ * Job index with the key it is sorted by.
+ */
+typedef struct {
+    uint64_t key;
+    int index;
+} ik_sort_item;
 
-        if(root->parent)
-        {   
-            LOG("%s", "Aligning child branches");
-            ik_vec2 from, to;
 
-            from.x = org_x - root->parent->position.x;
-            from.y = org_y - root->parent->position.y;
 
-            to.x = root->position.x - root->parent->position.x;
-            to.y = root->position.y - root->parent->position.y;
-            
-            for(int i = 0; i < root->n_children; i++)
-            {
-                ik_joint *child = root->children[i];
+/*
+ * Sorts 'n' items by key with least significant digit radix sort, using
+ *  'tmp' of the same size. Counts of all bytes are taken in one pass,
+ *  and bytes that are equal for all items are skipped. Returns whichever
+ *  of 'items' and 'tmp' holds the result.
+ */
+static ik_sort_item *ik_radix_sort(ik_sort_item *items, ik_sort_item *tmp, int n)
+{
+    int count[8][256] = { { 0 } };
+    for(int i = 0; i < n; i++)
+        for(int b = 0; b < 8; b++)
+            count[b][(items[i].key >> (8 * b)) & 0xff]++;
 
-                if(child != path_child)
-                    ik_align_branch(child, from, to);
-            }
-        } else {
-            /* Root of whole tree -> no parent to define orientation */
-            /*  -> only translate                                    */
-            LOG("%s", "Translating child branches");
-            for(int i = 0; i < root->n_children; i++)
-            {
-                ik_joint *child = root->children[i];
+    for(int b = 0; b < 8; b++)
+    {
+        if(count[b][(items[0].key >> (8 * b)) & 0xff] == n)
+            continue;
 
-                if(child != path_child)
-                    ik_align_branch_only_translate(
-                        child, 
-                        root->position.x - org_x, 
-                        root->position.y - org_y);
-            }
+        for(int d = 0, sum = 0; d < 256; d++)
+        {
+            int c = count[b][d];
+            count[b][d] = sum;
+            sum += c;
         }
-    } else {
-        path_child = root->children[0];
-    }
-    
+        for(int i = 0; i < n; i++)
+            tmp[count[b][(items[i].key >> (8 * b)) & 0xff]++] = items[i];
 
-    /* Recurse */
-    /* TODO: Use stack ? */
-    ik_reach_forward(
-        path_child,
-        path_child->length,
-        root->position.x,
-        root->position.y
-    );
+        ik_sort_item *swap = items;
+        items = tmp;
+        tmp = swap;
+    }
+    return items;
 }
 
 
-
-/*
- * Pushes vector to buffer.
- */
-static void ik_vertex_buffer_push(ik_vertex_buffer *buffer, ik_vec2 value)
+void ik_sort_solve_jobs(ik_solve_job *jobs, int n_jobs)
 {
-    if(buffer->size == buffer->cap)
+    if(n_jobs <= 0)
+        return;
+
+    float min_x = jobs[0].target_x, max_x = min_x;
+    float min_y = jobs[0].target_y, max_y = min_y;
+    uintptr_t min_address = (uintptr_t)jobs[0].skeleton, max_address = min_address;
+    for(int i = 1; i < n_jobs; i++)
     {
-        int new_cap = buffer->cap * 2;
-        ik_vec2 *new_data = IK_MALLOC(sizeof(ik_vec2) * new_cap);
+        if(jobs[i].target_x < min_x) min_x = jobs[i].target_x;
+        if(jobs[i].target_x > max_x) max_x = jobs[i].target_x;
+        if(jobs[i].target_y < min_y) min_y = jobs[i].target_y;
+        if(jobs[i].target_y > max_y) max_y = jobs[i].target_y;
+        if((uintptr_t)jobs[i].skeleton < min_address) min_address = (uintptr_t)jobs[i].skeleton;
+        if((uintptr_t)jobs[i].skeleton > max_address) max_address = (uintptr_t)jobs[i].skeleton;
+    }
 
-        memcpy(new_data, buffer->data, sizeof(ik_vec2) * buffer->size);
-        free(buffer->data);
+    /* Skeletons are more than 16 bytes apart, so their offsets from the
+     *  lowest one can drop 4 bits. The Morton code fills the bits below,
+     *  losing its lowest bits if offsets need more than 32. */
+    int address_bits = 0;
+    while(address_bits < 60 && ((max_address - min_address) >> 4) >> address_bits)
+        address_bits++;
+    int morton_shift = address_bits > 32 ? address_bits - 32 : 0;
 
-        buffer->data = new_data;
-        buffer->cap = new_cap;
+    /* Quantize targets to 16 bits per axis over their bounds */
+    float scale_x = max_x > min_x ? 65535.0f / (max_x - min_x) : 0.0f;
+    float scale_y = max_y > min_y ? 65535.0f / (max_y - min_y) : 0.0f;
+
+    unsigned long mark = ik_scratch_mark();
+    ik_sort_item *items = ik_scratch_alloc(sizeof(ik_sort_item) * n_jobs);
+    ik_sort_item *tmp = ik_scratch_alloc(sizeof(ik_sort_item) * n_jobs);
+
+    for(int i = 0; i < n_jobs; i++)
+    {
+        uint32_t x = (uint32_t)((jobs[i].target_x - min_x) * scale_x);
+        uint32_t y = (uint32_t)((jobs[i].target_y - min_y) * scale_y);
+        uint32_t morton = ik_spread_bits(x) | ik_spread_bits(y) << 1;
+        uint64_t address = ((uintptr_t)jobs[i].skeleton - min_address) >> 4;
+
+        items[i].key = address << (32 - morton_shift) | morton >> morton_shift;
+        items[i].index = i;
     }
 
-    buffer->data[buffer->size++] = value;
+    items = ik_radix_sort(items, tmp, n_jobs);
+
+    ik_solve_job *sorted = ik_scratch_alloc(sizeof(ik_solve_job) * n_jobs);
+    for(int i = 0; i < n_jobs; i++)
+        sorted[i] = jobs[items[i].index];
+    IK_MEMCPY(jobs, sorted, sizeof(ik_solve_job) * n_jobs);
+
+    ik_scratch_release(mark);
 }
 
 
-/*
- * Resets buffer data
- */
-static void ik_vertex_buffer_reset(ik_vertex_buffer *buffer) 
+int ik_solve_batch(ik_solve_job *jobs, int n_jobs)
 {
-    buffer->size = 0;
+    ik_sort_solve_jobs(jobs, n_jobs);
+
+    /* Consecutive jobs solving the same joint of a skeleton share a path */
+    unsigned long mark = ik_scratch_mark();
+    const ik_skeleton *skeleton = NULL;
+    int effected = -1, n_path = 0, *path = NULL;
+
+    int result = IK_OK;
+    for(int i = 0; i < n_jobs; i++)
+    {
+        ik_solve_job *job = &jobs[i];
+        if(job->skeleton != skeleton || job->effected != effected)
+        {
+            ik_scratch_release(mark);
+            skeleton = job->skeleton;
+            effected = job->effected;
+            n_path = ik_skeleton_find_path(skeleton, effected, &path);
+        }
+
+        job->status = n_path ? IK_OK : IK_ERROR;
+        if(n_path)
+            ik_skeleton_reach(skeleton, job->pose, path, n_path, job->target_x, job->target_y);
+        else
+            result = IK_ERROR;
+    }
+
+    ik_scratch_release(mark);
+    return result;
 }
 
 
-/*
- * Gets vertex data without reseting buffer, used recursively
- *  from ik_get_render_data.
- */
-static void ik_get_render_data_no_reset(ik_joint *root, ik_vertex_buffer *buffer)
+void ik_skeleton_translate(const ik_skeleton *skeleton, ik_vec2 *pose, float x, float y)
 {
-    for(int i = 0; i < root->n_children; i++)
+    float dx = x - pose[0].x;
+    float dy = y - pose[0].y;
+
+    for(int i = 0; i < skeleton->n_joints; i++)
     {
-        ik_joint *child = root->children[i];
-        ik_vertex_buffer_push(buffer, root->position);
-        ik_vertex_buffer_push(buffer, child->position);
-        ik_get_render_data_no_reset(child, buffer);
+        pose[i].x += dx;
+        pose[i].y += dy;
     }
 }
 
 
-/*
- * Translates branch by vector (dx, dy)
- */
-void ik_translate_relative(ik_joint *root, float dx, float dy)
+void ik_skeleton_renormalize(const ik_skeleton *skeleton, ik_vec2 *pose)
 {
-    root->position.x += dx;
-    root->position.y += dy;
-    for(int i = 0; i < root->n_children; i++)
-        ik_translate_relative(root->children[i], dx, dy);
+    /* Children come after parents, so going in reverse every parent   */
+    /*  is still absolute when its children are made relative to it.   */
+    for(int i = skeleton->n_joints - 1; i > 0; i--)
+    {
+        pose[i].x -= pose[skeleton->parent[i]].x;
+        pose[i].y -= pose[skeleton->parent[i]].y;
+    }
+
+    ik_scale_to_lengths(pose + 1, skeleton->length + 1, skeleton->n_joints - 1);
+
+    for(int i = 1; i < skeleton->n_joints; i++)
+    {
+        pose[i].x += pose[skeleton->parent[i]].x;
+        pose[i].y += pose[skeleton->parent[i]].y;
+    }
 }
 
 
+float ik_skeleton_max_length_error(const ik_skeleton *skeleton, const ik_vec2 *pose)
+{
+    float max_error = 0.0f;
 
-/**********************************************
- *            INTERFACE FUNCTIONS             *
- **********************************************/
+    for(int i = 1; i < skeleton->n_joints; i++)
+    {
+        ik_vec2 parent = pose[skeleton->parent[i]];
+        float error = length(pose[i].x - parent.x, pose[i].y - parent.y) - skeleton->length[i];
 
-void ik_init(void)
+        if(error < 0.0f)
+            error = -error;
+        if(error > max_error)
+            max_error = error;
+    }
+
+    return max_error;
+}
+
+
+void ik_skeleton_get_render_data(const ik_skeleton *skeleton, const ik_vec2 *pose,
+                                 ik_vertex_buffer *buffer)
 {
-    ik_stack.end = ik_stack.data;
+    ik_vertex_buffer_reset(buffer);
+
+    /* Depth first order of joints matches order of ik_get_render_data */
+    for(int i = 1; i < skeleton->n_joints; i++)
+    {
+        ik_vertex_buffer_push(buffer, pose[skeleton->parent[i]]);
+        ik_vertex_buffer_push(buffer, pose[i]);
+    }
 }
 
-ik_joint *ik_new_joint(float length, int n_children)
+
+int ik_skeleton_render_to_pool(const ik_skeleton *skeleton, const ik_vec2 *pose,
+                               ik_render_pool *pool)
 {
-    ik_joint *joint = IK_MALLOC(sizeof(ik_joint) + sizeof(ik_joint*) * n_children);
+    int first = ik_render_pool_reserve(pool, 2 * (skeleton->n_joints - 1));
+    if(first < 0)
+        return -1;
 
-    joint->position.x = 0.0f;
-    joint->position.y = 0.0f;
-    joint->length = length;
-    joint->parent = NULL;
-    joint->n_children = n_children;
-    for(int i = 0; i < n_children; i++)
-        joint->children[i] = NULL;
-    
-    return joint;
+    ik_vec2 *out = pool->data + first;
+    for(int i = 1; i < skeleton->n_joints; i++)
+    {
+        *out++ = pose[skeleton->parent[i]];
+        *out++ = pose[i];
+    }
+    return first;
 }
 
 
-void ik_delete_branch(ik_joint *root)
+void ik_pose_lerp(ik_vec2 *out, const ik_vec2 *a, const ik_vec2 *b, float t, int n_joints)
 {
-    for(int i = 0; i < root->n_children; i++)
-        if(root->children[i])
-            ik_delete_branch(root->children[i]);
+    /* Operate on components, so that the loop is easily vectorized */
+    float *o = (float*)out;
+    const float *fa = (const float*)a;
+    const float *fb = (const float*)b;
 
-    IK_FREE(root);
+    for(int i = 0; i < 2 * n_joints; i++)
+        o[i] = fa[i] + t * (fb[i] - fa[i]);
 }
 
 
-int ik_attach_joint(ik_joint *child, ik_joint *parent)
+void ik_pose_nlerp(const ik_skeleton *skeleton, ik_vec2 *out, 
+                   const ik_vec2 *a, const ik_vec2 *b, float t)
 {
-    for(int i = 0; i < parent->n_children; i++)
-        if(parent->children[i] == NULL) {
-            parent->children[i] = child;
-            child->parent = parent;
-            return IK_OK;
-        }
-    return IK_ERROR;
+    ik_pose_nlerp_weighted(skeleton, out, a, b, t, NULL);
 }
 
 
-void ik_translate(ik_joint *root, float x, float y)
+void ik_pose_blend_masked(const ik_skeleton *skeleton, ik_vec2 *out,
+                          const ik_vec2 *a, const ik_vec2 *b, const float *weights)
 {
-    float dx = x - root->position.x;
-    float dy = y - root->position.y;
-    ik_translate_relative(root, dx, dy);
+    ik_pose_nlerp_weighted(skeleton, out, a, b, 0.0f, weights);
 }
 
 
-int ik_solve(ik_joint *effected, float target_x, float target_y)
+void ik_pose_mask_branch(const ik_skeleton *skeleton, float *weights, int branch, float weight)
 {
-    LOG("%s", "\n *** SOLVE BEGIN ***\n");
-    ik_joint *root;
-    float root_org_x, root_org_y;
+    int end = branch + skeleton->subtree_size[branch];
+    for(int i = branch; i < end; i++)
+        weights[i] = weight;
+}
 
-    ik_reach_back(
-        effected, 
-        target_x, 
-        target_y, 
-        0.0f, 
-        &root, 
-        &root_org_x, 
-        &root_org_y
-    );
 
-    ik_reach_forward(
-        root, 
-        0.0f, 
-        root_org_x, 
-        root_org_y
-    );
+void ik_pose_additive(const ik_skeleton *skeleton, ik_vec2 *out, const ik_vec2 *base,
+                      const ik_vec2 *reference, const ik_vec2 *additive, float weight)
+{
+    const int *parent = skeleton->parent;
+    ik_vec2 origin = { 0.0f, 0.0f };
 
-    LOG("%s", "\n *** SOLVE END ***\n");
-    return 1;
+    /* Same two passes as ik_pose_nlerp_weighted, see there */
+    for(int i = skeleton->n_joints - 1; i > 0; i--)
+    {
+        float bx = base[i].x - base[parent[i]].x;
+        float by = base[i].y - base[parent[i]].y;
+        float rx = reference[i].x - reference[parent[i]].x;
+        float ry = reference[i].y - reference[parent[i]].y;
+        float ax = additive[i].x - additive[parent[i]].x;
+        float ay = additive[i].y - additive[parent[i]].y;
+
+        /* Rotation from reference to additive, as unnormalized complex number */
+        float rot_x = rx * ax + ry * ay;
+        float rot_y = rx * ay - ry * ax;
+        float rot_len = length(rot_x, rot_y);
+        
+        out[i].x = bx;
+        out[i].y = by;
+        if(rot_len == 0.0f)
+            continue;
+
+        /* Scale rotation by weight, interpolating from identity */
+        rot_x = 1.0f + weight * (rot_x / rot_len - 1.0f);
+        rot_y = weight * rot_y / rot_len;
+
+        ik_place_at_dist(&out[i], origin, skeleton->length[i],
+                         rot_x * bx - rot_y * by, rot_y * bx + rot_x * by);
+    }
+
+    out[0].x = base[0].x + weight * (additive[0].x - reference[0].x);
+    out[0].y = base[0].y + weight * (additive[0].y - reference[0].y);
+
+    for(int i = 1; i < skeleton->n_joints; i++)
+    {
+        out[i].x += out[parent[i]].x;
+        out[i].y += out[parent[i]].y;
+    }
 }
 
 
-void ik_get_render_data(ik_joint *root, ik_vertex_buffer *buffer)
+ik_pose_buffer ik_new_pose_buffer(int n_joints)
 {
-    ik_vertex_buffer_reset(buffer);
-    ik_get_render_data_no_reset(root, buffer);
+    ik_pose_buffer buffer;
+    buffer.n_joints = n_joints;
+    buffer.back = 0;
+    buffer.middle = 1;
+    buffer.front = 2;
+    buffer.data = ik_malloc(sizeof(ik_vec2) * n_joints * 3);
+
+    return buffer;
 }
 
 
-ik_vertex_buffer ik_new_vertex_buffer(void)
+void ik_free_pose_buffer(ik_pose_buffer *buffer)
 {
-    ik_vertex_buffer buffer;
-    buffer.cap = 10;
-    buffer.size = 0;
-    buffer.data = IK_MALLOC(sizeof(ik_vec2) * buffer.cap);
+    ik_free(buffer->data);
+    buffer->n_joints = 0;
+}
 
-    return buffer;
+
+ik_vec2 *ik_pose_buffer_back(ik_pose_buffer *buffer)
+{
+    return buffer->data + buffer->back * buffer->n_joints;
 }
 
 
-void ik_free_vertex_buffer(ik_vertex_buffer *buffer)
+void ik_pose_buffer_publish(ik_pose_buffer *buffer)
 {
-    IK_FREE(buffer->data);
-    buffer->cap = 0;
-    buffer->size = 0;
+    int old = IK_ATOMIC_EXCHANGE(&buffer->middle, buffer->back | IK_POSE_FRESH);
+    buffer->back = old & ~IK_POSE_FRESH;
+}
+
+
+void ik_publish_pose(ik_joint *root, ik_pose_buffer *buffer)
+{
+    ik_get_pose(root, ik_pose_buffer_back(buffer));
+    ik_pose_buffer_publish(buffer);
+}
+
+
+const ik_vec2 *ik_pose_buffer_front(ik_pose_buffer *buffer)
+{
+    if(IK_ATOMIC_LOAD(&buffer->middle) & IK_POSE_FRESH)
+    {
+        int old = IK_ATOMIC_EXCHANGE(&buffer->middle, buffer->front);
+        buffer->front = old & ~IK_POSE_FRESH;
+    }
+
+    return buffer->data + buffer->front * buffer->n_joints;
 }
 
 #endif /* IKSOLVER_IMPLEMENTATION */
\ No newline at end of file
@@ -0,0 +1,273 @@
+/*
+ * C++ interface to iksolver.h, owning skeletons, vertex buffers and
+ *  joint trees with move-only types, and allocating from std::pmr
+ *  memory resources. Requires C++20 for std::span. The implementation
+ *  is compiled from iksolver.h as C, as for C users, with IK_ALLOCATOR
+ *  defined there and here.
+ */
+
+#ifndef IKSOLVER_HPP
+#define IKSOLVER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <utility>
+
+#include "iksolver.h"
+
+#ifndef IK_ALLOCATOR
+# error "iksolver.hpp requires IK_ALLOCATOR, see ik_set_allocator"
+#endif
+
+namespace ik {
+
+/**********************************************
+ *                 ALLOCATION                 *
+ **********************************************/
+
+/*
+ * Routes memory allocated by the calling thread to 'resource' while in
+ *  scope, restoring the previous allocator when destroyed. A null
+ *  'resource' selects IK_MALLOC and IK_FREE. Memory is returned to the
+ *  resource it came from, so the resource must outlive everything
+ *  allocated from it, including scratch memory (see ik_free_scratch).
+ *  Allocation failure terminates, as solver code can't unwind.
+ */
+class ResourceScope
+{
+public:
+    explicit ResourceScope(std::pmr::memory_resource *resource) noexcept
+    {
+        ik_allocator allocator = { &allocate, &deallocate, resource };
+        previous_ = ik_set_allocator(resource ? &allocator : nullptr);
+    }
+
+    ~ResourceScope()
+    {
+        ik_set_allocator(&previous_);
+    }
+
+    ResourceScope(const ResourceScope&) = delete;
+    ResourceScope &operator=(const ResourceScope&) = delete;
+
+private:
+    static void *allocate(void *user, std::size_t size) noexcept
+    {
+        return static_cast<std::pmr::memory_resource*>(user)->allocate(size, alignof(std::max_align_t));
+    }
+
+    static void deallocate(void *user, void *ptr, std::size_t size) noexcept
+    {
+        static_cast<std::pmr::memory_resource*>(user)->deallocate(ptr, size, alignof(std::max_align_t));
+    }
+
+    ik_allocator previous_;
+};
+
+
+
+/**********************************************
+ *                JOINT TREES                 *
+ **********************************************/
+
+struct BranchDeleter
+{
+    void operator()(ik_joint *root) const noexcept
+    {
+        ik_delete_branch(root);
+    }
+};
+
+/*
+ * Owning pointer to a joint tree. Attaching a tree to a parent moves
+ *  ownership to the parent, so release it after ik_attach_joint.
+ */
+using Branch = std::unique_ptr<ik_joint, BranchDeleter>;
+
+/*
+ * Creates joint like ik_new_joint, allocated from 'resource'.
+ */
+inline Branch make_joint(float length, int n_children, std::pmr::memory_resource *resource = nullptr)
+{
+    ResourceScope scope(resource);
+    return Branch(ik_new_joint(length, n_children));
+}
+
+/*
+ * Positions of tree in depth first order, see ik_get_pose.
+ *  'pose' must hold ik_count_joints(root) entries.
+ */
+inline void get_pose(ik_joint *root, std::span<ik_vec2> pose)
+{
+    ik_get_pose(root, pose.data());
+}
+
+inline void set_pose(ik_joint *root, std::span<const ik_vec2> pose)
+{
+    ik_set_pose(root, pose.data());
+}
+
+
+
+/**********************************************
+ *                 SKELETONS                  *
+ **********************************************/
+
+/*
+ * Owning handle to an ik_skeleton. Poses are spans of n_joints()
+ *  positions, and are not checked against the skeleton.
+ */
+class Skeleton
+{
+public:
+    Skeleton() noexcept = default;
+
+    /*
+     * Creates skeleton of tree like ik_new_skeleton, allocated from
+     *  'resource'.
+     */
+    explicit Skeleton(ik_joint *root, std::pmr::memory_resource *resource = nullptr)
+    {
+        ResourceScope scope(resource);
+        skeleton_ = ik_new_skeleton(root);
+    }
+
+    /*
+     * Takes ownership of skeleton created with ik_new_skeleton.
+     */
+    explicit Skeleton(ik_skeleton *skeleton) noexcept : skeleton_(skeleton) {}
+
+    Skeleton(Skeleton &&other) noexcept : skeleton_(std::exchange(other.skeleton_, nullptr)) {}
+
+    Skeleton &operator=(Skeleton &&other) noexcept
+    {
+        std::swap(skeleton_, other.skeleton_);
+        return *this;
+    }
+
+    Skeleton(const Skeleton&) = delete;
+    Skeleton &operator=(const Skeleton&) = delete;
+
+    ~Skeleton()
+    {
+        if(skeleton_)
+            ik_delete_skeleton(skeleton_);
+    }
+
+    explicit operator bool() const noexcept { return skeleton_ != nullptr; }
+    const ik_skeleton *get() const noexcept { return skeleton_; }
+    ik_skeleton *release() noexcept { return std::exchange(skeleton_, nullptr); }
+
+    int n_joints() const noexcept { return skeleton_->n_joints; }
+
+    std::span<const int> parents() const noexcept { return { skeleton_->parent, size() }; }
+    std::span<const float> lengths() const noexcept { return { skeleton_->length, size() }; }
+
+    /*
+     * Solves joint 'effected' towards target like ik_skeleton_solve,
+     *  returning false if it is not a valid index.
+     */
+    bool solve(std::span<ik_vec2> pose, int effected, float target_x, float target_y) const
+    {
+        return ik_skeleton_solve(skeleton_, pose.data(), effected, target_x, target_y) == IK_OK;
+    }
+
+    void translate(std::span<ik_vec2> pose, float x, float y) const
+    {
+        ik_skeleton_translate(skeleton_, pose.data(), x, y);
+    }
+
+    void renormalize(std::span<ik_vec2> pose) const
+    {
+        ik_skeleton_renormalize(skeleton_, pose.data());
+    }
+
+    float max_length_error(std::span<const ik_vec2> pose) const
+    {
+        return ik_skeleton_max_length_error(skeleton_, pose.data());
+    }
+
+private:
+    std::size_t size() const noexcept { return static_cast<std::size_t>(skeleton_->n_joints); }
+
+    ik_skeleton *skeleton_ = nullptr;
+};
+
+
+
+/**********************************************
+ *                 RENDERING                  *
+ **********************************************/
+
+/*
+ * Owning handle to an ik_vertex_buffer, growing within the resource it
+ *  was created with.
+ */
+class VertexBuffer
+{
+public:
+    explicit VertexBuffer(std::pmr::memory_resource *resource = nullptr) : resource_(resource)
+    {
+        ResourceScope scope(resource_);
+        buffer_ = ik_new_vertex_buffer();
+    }
+
+    VertexBuffer(VertexBuffer &&other) noexcept
+        : buffer_(std::exchange(other.buffer_, ik_vertex_buffer{})), resource_(other.resource_) {}
+
+    VertexBuffer &operator=(VertexBuffer &&other) noexcept
+    {
+        std::swap(buffer_, other.buffer_);
+        std::swap(resource_, other.resource_);
+        return *this;
+    }
+
+    VertexBuffer(const VertexBuffer&) = delete;
+    VertexBuffer &operator=(const VertexBuffer&) = delete;
+
+    ~VertexBuffer()
+    {
+        if(buffer_.data)
+            ik_free_vertex_buffer(&buffer_);
+    }
+
+    /*
+     * Vertices of segments as consecutive pairs, valid until the buffer
+     *  is filled again.
+     */
+    std::span<const ik_vec2> vertices() const noexcept
+    {
+        return { buffer_.data, static_cast<std::size_t>(buffer_.size) };
+    }
+
+    ik_vertex_buffer *get() noexcept { return &buffer_; }
+
+    /*
+     * Fills buffer with render data of tree, see ik_get_render_data.
+     */
+    void assign(ik_joint *root)
+    {
+        ResourceScope scope(resource_);
+        ik_get_render_data(root, &buffer_);
+    }
+
+    /*
+     * Fills buffer with render data of pose, see
+     *  ik_skeleton_get_render_data.
+     */
+    void assign(const Skeleton &skeleton, std::span<const ik_vec2> pose)
+    {
+        ResourceScope scope(resource_);
+        ik_skeleton_get_render_data(skeleton.get(), pose.data(), &buffer_);
+    }
+
+private:
+    ik_vertex_buffer buffer_ = {};
+    std::pmr::memory_resource *resource_ = nullptr;
+};
+
+} // namespace ik
+
+#endif /* IKSOLVER_HPP */
@@ -0,0 +1,103 @@
+/*
+ * Checks that C++ owning types stay usable after being moved from, and
+ *  return all memory to the resource they were created with.
+ */
+
+#include <cstdio>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "iksolver.hpp"
+
+#define N_JOINTS 40
+
+
+
+/*
+ * Memory resource counting outstanding bytes.
+ */
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    std::size_t in_use = 0;
+
+private:
+    void *do_allocate(std::size_t size, std::size_t alignment) override
+    {
+        in_use += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t size, std::size_t alignment) override
+    {
+        in_use -= size;
+        std::pmr::new_delete_resource()->deallocate(ptr, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+
+
+/*
+ * Creates chain long enough to grow a vertex buffer several times.
+ */
+static ik::Branch make_chain(std::pmr::memory_resource *resource)
+{
+    ik::Branch root = ik::make_joint(0.0f, 1, resource);
+    ik_joint *parent = root.get();
+    for(int i = 0; i < N_JOINTS; i++)
+    {
+        ik::Branch joint = ik::make_joint(1.0f, i + 1 < N_JOINTS ? 1 : 0, resource);
+        joint->position.x = (float)(i + 1);
+        ik_attach_joint(joint.get(), parent);
+        parent = joint.release();
+    }
+    return root;
+}
+
+
+static int check(bool ok, const char *what)
+{
+    if(!ok)
+        std::printf("FAILED: %s\n", what);
+    return ok ? 0 : 1;
+}
+
+
+int main()
+{
+    ik_init();
+
+    CountingResource resource;
+    int failures = 0;
+    {
+        ik::Branch root = make_chain(&resource);
+
+        ik::VertexBuffer buffer(&resource);
+        ik::VertexBuffer moved(std::move(buffer));
+        buffer.assign(root.get());
+        failures += check(buffer.vertices().size() == 2 * N_JOINTS, "moved from vertex buffer, tree");
+
+        ik::Skeleton skeleton(root.get(), &resource);
+        ik::Skeleton other(std::move(skeleton));
+        skeleton = ik::Skeleton(root.get(), &resource);
+        failures += check(skeleton && skeleton.n_joints() == N_JOINTS + 1, "moved from skeleton");
+
+        std::vector<ik_vec2> pose((std::size_t)skeleton.n_joints());
+        ik::get_pose(root.get(), pose);
+        failures += check(skeleton.solve(pose, N_JOINTS, 10.0f, 20.0f), "solve");
+
+        ik::VertexBuffer last(std::move(moved));
+        moved.assign(skeleton, pose);
+        failures += check(moved.vertices().size() == 2 * N_JOINTS, "moved from vertex buffer, skeleton");
+    }
+    ik_free_scratch();
+    failures += check(resource.in_use == 0, "memory returned to resource");
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Checks that alternative ways of solving a branched tree give the same
+ *  pose as plain eager solving: deferred alignment, relaid out trees,
+ *  joints owned by a pool, and render data filled while solving.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "iksolver.h"
+
+#define N_SPINE 10
+#define N_SIDE 3
+#define N_JOINTS (1 + N_SPINE + (N_SPINE - 1) * N_SIDE)
+#define N_SOLVES 200
+#define N_DEFERRED_WINDOW 20
+#define MAX_DEFERRED_ERROR 1e-3f
+
+
+
+/*
+ * Builds spine curving up from the x axis, so that no solve starts
+ *  from a straight chain, with a side branch rising from every spine
+ *  joint but the last. Joints are taken from 'pool' if it is not NULL.
+ */
+static ik_joint *new_tree(ik_joint_pool *pool, ik_handle *root_handle)
+{
+    ik_handle parent_handle = 0, spine_handle = 0;
+    ik_joint *root = NULL, *spine = NULL;
+
+    for(int i = 0; i <= N_SPINE; i++)
+    {
+        int n_children = i == N_SPINE ? 0 : i == 0 ? 1 : 2;
+        ik_handle handle = pool ? ik_pool_new_joint(pool, i ? 1.0f : 0.0f, n_children) : 0;
+        ik_joint *joint = pool ? ik_pool_get(pool, handle) : ik_new_joint(i ? 1.0f : 0.0f, n_children);
+        if(spine)
+        {
+            joint->position.x = spine->position.x + cosf(i * 0.1f);
+            joint->position.y = spine->position.y + sinf(i * 0.1f);
+        }
+
+        if(!spine)
+        {
+            root = joint;
+            *root_handle = handle;
+        } else if(pool) {
+            ik_pool_attach(pool, handle, spine_handle);
+        } else {
+            ik_attach_joint(joint, spine);
+        }
+        spine = joint;
+        spine_handle = handle;
+
+        if(i == 0 || i == N_SPINE)
+            continue;
+
+        ik_joint *side = spine;
+        parent_handle = spine_handle;
+        for(int k = 0; k < N_SIDE; k++)
+        {
+            ik_handle side_handle = pool ? ik_pool_new_joint(pool, 0.5f, k + 1 < N_SIDE) : 0;
+            ik_joint *joint = pool ? ik_pool_get(pool, side_handle) : ik_new_joint(0.5f, k + 1 < N_SIDE);
+            joint->position.x = side->position.x + 0.3f;
+            joint->position.y = side->position.y + 0.4f;
+
+            if(pool)
+                ik_pool_attach(pool, side_handle, parent_handle);
+            else
+                ik_attach_joint(joint, side);
+            side = joint;
+            parent_handle = side_handle;
+        }
+    }
+    return root;
+}
+
+
+/*
+ * Returns joint at 'index' in depth first order.
+ */
+static ik_joint *joint_at(ik_joint *root, int index)
+{
+    while(index > 0)
+    {
+        index--;
+        int i = 0;
+        for(; i < root->n_children; i++)
+        {
+            int size = ik_count_joints(root->children[i]);
+            if(index < size)
+                break;
+            index -= size;
+        }
+        root = root->children[i];
+    }
+    return root;
+}
+
+
+/*
+ * Solve 'i' of the shared sequence, alternating between the spine tip,
+ *  a side branch tip and a joint in the middle of a side branch. Side
+ *  branches come before the rest of the spine in depth first order.
+ */
+static void solve_target(int i, int *effected, float *x, float *y)
+{
+    static const int effected_joints[3] = { N_JOINTS - 1, 1 + 3 * (N_SIDE + 1) + N_SIDE, 1 + 5 * (N_SIDE + 1) + 2 };
+    *effected = effected_joints[i % 3];
+    *x = 6.0f * cosf(i * 0.37f) + 3.0f;
+    *y = 6.0f * sinf(i * 0.53f);
+}
+
+
+static float max_difference(const ik_vec2 *a, const ik_vec2 *b, int n)
+{
+    float max = 0.0f;
+    for(int i = 0; i < n; i++)
+    {
+        float d = fabsf(a[i].x - b[i].x) + fabsf(a[i].y - b[i].y);
+        if(d > max)
+            max = d;
+    }
+    return max;
+}
+
+
+/*
+ * Solves sequence on tree, returning pose.
+ */
+static void solve_sequence(ik_joint *root, ik_vec2 *pose)
+{
+    for(int i = 0; i < N_SOLVES; i++)
+    {
+        int effected;
+        float x, y;
+        solve_target(i, &effected, &x, &y);
+        ik_solve(joint_at(root, effected), x, y);
+    }
+    ik_get_pose(root, pose);
+}
+
+
+/*
+ * Solves an eager and a deferred tree in windows, returning largest
+ *  difference between their poses at the end of a window. Spine tip
+ *  solves leave side branches pending, and every window ends with a
+ *  small move of the side branch of the first spine joint, solving
+ *  through it's pending transform. Single passes amplify rounding
+ *  differences when a joint moves close to the old position of a
+ *  neighbour, so trees are synchronized after every window.
+ */
+static float deferred_difference(void)
+{
+    ik_handle handle;
+    ik_joint *eager = new_tree(NULL, &handle);
+    ik_joint *deferred = new_tree(NULL, &handle);
+    ik_vec2 eager_pose[N_JOINTS], deferred_pose[N_JOINTS];
+    float max = 0.0f;
+
+    for(int i = 0; i < N_SOLVES; i++)
+    {
+        int effected, end = (i + 1) % N_DEFERRED_WINDOW == 0;
+        float x, y;
+        solve_target(i, &effected, &x, &y);
+        effected = end ? 1 + N_SIDE : N_JOINTS - 1;
+        if(end)
+        {
+            ik_joint *joint = joint_at(eager, effected);
+            x = joint->position.x + 0.2f;
+            y = joint->position.y - 0.1f;
+        }
+        ik_solve(joint_at(eager, effected), x, y);
+        ik_set_deferred_alignment(1);
+        ik_solve(joint_at(deferred, effected), x, y);
+        ik_set_deferred_alignment(0);
+
+        if(!end)
+            continue;
+
+        ik_get_pose(eager, eager_pose);
+        ik_get_pose(deferred, deferred_pose);
+        float difference = max_difference(eager_pose, deferred_pose, N_JOINTS);
+        if(!(difference <= max))
+            max = difference;
+        ik_set_pose(deferred, eager_pose);
+    }
+
+    ik_delete_branch(eager);
+    ik_delete_branch(deferred);
+    return max;
+}
+
+
+static int compare_segments(const void *a, const void *b)
+{
+    const float *p = a, *q = b;
+    for(int i = 0; i < 4; i++)
+        if(p[i] != q[i])
+            return p[i] < q[i] ? -1 : 1;
+    return 0;
+}
+
+
+/*
+ * Solves sequence with ik_solve_render, returning number of solves whose
+ *  segments differ from ik_get_render_data.
+ */
+static int render_mismatches(ik_joint *root)
+{
+    ik_vertex_buffer solved = ik_new_vertex_buffer();
+    ik_vertex_buffer read = ik_new_vertex_buffer();
+    int mismatches = 0;
+
+    for(int i = 0; i < N_SOLVES; i++)
+    {
+        int effected;
+        float x, y;
+        solve_target(i, &effected, &x, &y);
+        ik_solve_render(joint_at(root, effected), x, y, &solved);
+        ik_get_render_data(root, &read);
+
+        /* Segments are pairs of vertices, and their order may differ */
+        qsort(solved.data, solved.size / 2, 2 * sizeof(ik_vec2), compare_segments);
+        qsort(read.data, read.size / 2, 2 * sizeof(ik_vec2), compare_segments);
+        if(solved.size != read.size || max_difference(solved.data, read.data, read.size) != 0.0f)
+            mismatches++;
+    }
+
+    ik_free_vertex_buffer(&solved);
+    ik_free_vertex_buffer(&read);
+    return mismatches;
+}
+
+
+int main(void)
+{
+    ik_init();
+
+    ik_handle handle;
+    ik_vec2 eager[N_JOINTS], pose[N_JOINTS];
+    int failed = 0;
+
+    ik_joint *root = new_tree(NULL, &handle);
+    solve_sequence(root, eager);
+    ik_delete_branch(root);
+
+    float difference = deferred_difference();
+    if(!(difference <= MAX_DEFERRED_ERROR))
+    {
+        printf("deferred: pose differs by %g\n", difference);
+        failed = 1;
+    }
+
+    static const struct { const char *name; int layout; } layouts[] = {
+        { "dfs", IK_LAYOUT_DFS },
+        { "veb", IK_LAYOUT_VEB },
+    };
+    for(int i = 0; i < 2; i++)
+    {
+        root = ik_relayout(new_tree(NULL, &handle), layouts[i].layout);
+        solve_sequence(root, pose);
+        ik_delete_branch(root);
+        if(max_difference(eager, pose, N_JOINTS) != 0.0f)
+        {
+            printf("relayout %s: pose differs by %g\n", layouts[i].name, max_difference(eager, pose, N_JOINTS));
+            failed = 1;
+        }
+
+        ik_joint_pool pool = ik_new_joint_pool();
+        new_tree(&pool, &handle);
+        ik_pool_relayout(&pool, handle, layouts[i].layout);
+        solve_sequence(ik_pool_get(&pool, handle), pose);
+        ik_free_joint_pool(&pool);
+        if(max_difference(eager, pose, N_JOINTS) != 0.0f)
+        {
+            printf("pool relayout %s: pose differs by %g\n", layouts[i].name, max_difference(eager, pose, N_JOINTS));
+            failed = 1;
+        }
+    }
+
+    root = new_tree(NULL, &handle);
+    int mismatches = render_mismatches(root);
+    ik_delete_branch(root);
+    if(mismatches)
+    {
+        printf("render: %d of %d solves differ from ik_get_render_data\n", mismatches, N_SOLVES);
+        failed = 1;
+    }
+
+    ik_free_scratch();
+    return failed;
+}
@@ -0,0 +1,74 @@
+/*
+ * Checks that iterative solvers keep segment lengths over many solves.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "iksolver.h"
+
+#define N_JOINTS 12
+#define N_SOLVES 30000
+#define MAX_LENGTH_ERROR 1e-5f
+
+
+
+/*
+ * Solves chain towards a wandering target, returning largest segment
+ *  length error afterwards.
+ */
+static float length_error_after_solves(int solver, int constrained)
+{
+    ik_joint *root = ik_new_joint(0.0f, 1);
+    ik_joint *effected = root;
+    for(int i = 0; i < N_JOINTS; i++)
+    {
+        ik_joint *joint = ik_new_joint(1.0f, 1);
+        joint->position.x = (float)(i + 1);
+        if(constrained && i > 0)
+            ik_set_constraint(joint, -0.6f, 0.6f);
+        ik_attach_joint(joint, effected);
+        effected = joint;
+    }
+
+    ik_solve_params params = ik_default_solve_params();
+    params.solver = solver;
+    for(int i = 0; i < N_SOLVES; i++)
+        ik_solve_iterative(effected, 8.0f * cosf(i * 0.37f), 8.0f * sinf(i * 0.53f), &params, NULL);
+
+    ik_vec2 pose[N_JOINTS + 1];
+    ik_get_pose(root, pose);
+    ik_skeleton *skeleton = ik_new_skeleton(root);
+    float error = ik_skeleton_max_length_error(skeleton, pose);
+
+    ik_delete_skeleton(skeleton);
+    ik_delete_branch(root);
+    return error;
+}
+
+
+int main(void)
+{
+    static const struct { const char *name; int solver; int constrained; } cases[] = {
+        { "ccd", IK_SOLVER_CCD, 0 },
+        { "ccd constrained", IK_SOLVER_CCD, 1 },
+        { "dls", IK_SOLVER_DLS, 0 },
+        { "dls constrained", IK_SOLVER_DLS, 1 },
+    };
+
+    ik_init();
+
+    int failed = 0;
+    for(int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++)
+    {
+        float error = length_error_after_solves(cases[i].solver, cases[i].constrained);
+        if(!(error <= MAX_LENGTH_ERROR))
+        {
+            printf("%s: length error %g after %d solves\n", cases[i].name, error, N_SOLVES);
+            failed = 1;
+        }
+    }
+
+    ik_free_scratch();
+    return failed;
+}
@@ -0,0 +1,351 @@
+/*
+ * Command line tool solving IK for a stream of targets.
+ *
+ * Usage: iksolver_cli -s SKELETON -e EFFECTOR [options]
+ *        iksolver_cli -r LOG
+ *
+ *  -s FILE     skeleton description
+ *  -e INDEX    index of effected joint in skeleton description
+ *  -i FILE     read targets from FILE instead of stdin
+ *  -o FILE     write poses to FILE instead of stdout
+ *  -b          read targets as binary float pairs instead of CSV
+ *  -B          write poses as binary float pairs instead of CSV
+ *  -n COUNT    number of targets solved per block (default 4096)
+ *  -r FILE     replay log written by ik_record_begin and print timing
+ *
+ * Skeleton description is a text file beginning with the number of 
+ *  joints, followed by one line per joint:
+ *
+ *      PARENT LENGTH X Y [MIN_ANGLE MAX_ANGLE]
+ *
+ *  where PARENT is the index of an earlier joint, or -1 for the root,
+ *  which must be the first joint. Lines beginning with '#' are ignored.
+ *
+ * CSV targets are lines of "X,Y". Each solved pose is written as one
+ *  line (or record) of joint positions, in skeleton description order.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iksolver.h"
+
+#define IO_BUFFER_SIZE (1 << 20)
+
+
+
+/*
+ * Skeleton loaded from description, with mapping from description 
+ *  order to skeleton order.
+ */
+typedef struct {
+    ik_skeleton *skeleton;
+    ik_vec2 *pose;
+    int *order;
+} cli_skeleton;
+
+
+
+/*
+ * Reads next line that is not empty or a comment.
+ */
+static char *read_line(char *line, int size, FILE *file)
+{
+    while(fgets(line, size, file))
+    {
+        char *c = line;
+        while(*c == ' ' || *c == '\t')
+            c++;
+
+        if(*c != '#' && *c != '\n' && *c != '\r' && *c != '\0')
+            return c;
+    }
+    return NULL;
+}
+
+
+
+/*
+ * Loads skeleton description. Returns IK_ERROR on malformed input.
+ */
+static int load_skeleton(const char *path, cli_skeleton *out)
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+    {
+        fprintf(stderr, "iksolver_cli: cannot open '%s'\n", path);
+        return IK_ERROR;
+    }
+
+    char line[256];
+    char *c = read_line(line, sizeof(line), file);
+    int n = c ? atoi(c) : 0;
+    if(n <= 0)
+    {
+        fprintf(stderr, "iksolver_cli: missing joint count in '%s'\n", path);
+        fclose(file);
+        return IK_ERROR;
+    }
+
+    int *parent = malloc(sizeof(int) * n);
+    int *n_children = calloc(n, sizeof(int));
+    float *values = malloc(sizeof(float) * 5 * n);
+    int *constrained = calloc(n, sizeof(int));
+    int ok = 1;
+
+    for(int i = 0; i < n && ok; i++)
+    {
+        float *v = values + 5 * i;
+        c = read_line(line, sizeof(line), file);
+
+        int fields = c ? sscanf(c, "%d %f %f %f %f %f", &parent[i], &v[0], &v[1], &v[2], &v[3], &v[4]) : 0;
+        constrained[i] = fields == 6;
+
+        ok = (fields == 4 || fields == 6) 
+            && (i == 0 ? parent[i] == -1 : parent[i] >= 0 && parent[i] < i);
+
+        if(ok && i > 0)
+            n_children[parent[i]]++;
+        if(!ok)
+            fprintf(stderr, "iksolver_cli: invalid joint %d in '%s'\n", i, path);
+    }
+    fclose(file);
+
+    if(ok)
+    {
+        ik_joint **joints = malloc(sizeof(ik_joint*) * n);
+
+        for(int i = 0; i < n; i++)
+        {
+            float *v = values + 5 * i;
+            joints[i] = ik_new_joint(v[0], n_children[i]);
+            joints[i]->position.x = v[1];
+            joints[i]->position.y = v[2];
+            if(constrained[i])
+                ik_set_constraint(joints[i], v[3], v[4]);
+            if(i > 0)
+                ik_attach_joint(joints[i], joints[parent[i]]);
+        }
+
+        out->skeleton = ik_new_skeleton(joints[0]);
+        out->pose = malloc(sizeof(ik_vec2) * n);
+        out->order = malloc(sizeof(int) * n);
+        ik_get_pose(joints[0], out->pose);
+
+        for(int i = 0; i < n; i++)
+            out->order[i] = ik_joint_index(joints[0], joints[i]);
+
+        ik_delete_branch(joints[0]);
+        free(joints);
+    }
+
+    free(parent);
+    free(n_children);
+    free(values);
+    free(constrained);
+    return ok ? IK_OK : IK_ERROR;
+}
+
+
+
+/*
+ * Reads up to 'max' targets, returning number read.
+ */
+static int read_targets(FILE *file, int binary, ik_vec2 *targets, int max)
+{
+    if(binary)
+        return (int)fread(targets, sizeof(ik_vec2), max, file);
+
+    char line[256];
+    int n = 0;
+    while(n < max && fgets(line, sizeof(line), file))
+    {
+        char *end;
+        targets[n].x = strtof(line, &end);
+        if(end == line)
+            continue;
+
+        while(*end == ',' || *end == ' ' || *end == '\t')
+            end++;
+        targets[n].y = strtof(end, NULL);
+        n++;
+    }
+    return n;
+}
+
+
+
+/*
+ * Writes poses in description order.
+ */
+static void write_poses(FILE *file, int binary, const cli_skeleton *skel, const ik_vec2 *poses, int n_poses)
+{
+    int n = skel->skeleton->n_joints;
+
+    for(int p = 0; p < n_poses; p++)
+    {
+        const ik_vec2 *pose = poses + p * n;
+
+        for(int i = 0; i < n; i++)
+        {
+            ik_vec2 position = pose[skel->order[i]];
+            if(binary)
+                fwrite(&position, sizeof(ik_vec2), 1, file);
+            else
+                fprintf(file, i == 0 ? "%g,%g" : ",%g,%g", position.x, position.y);
+        }
+
+        if(!binary)
+            fputc('\n', file);
+    }
+}
+
+
+
+/*
+ * Replays recorded log and prints timing.
+ */
+static int replay(const char *path)
+{
+    ik_replay_stats stats;
+
+    if(ik_replay(path, &stats) != IK_OK)
+    {
+        fprintf(stderr, "iksolver_cli: cannot replay '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+
+    printf("solves:      %d\n", stats.n_solves);
+    printf("translates:  %d\n", stats.n_translates);
+    printf("total:       %.3f ms\n", stats.total_ns / 1e6);
+    if(stats.n_solves > 0)
+    {
+        printf("mean solve:  %.3f us\n", stats.total_ns / 1e3 / stats.n_solves);
+        printf("max solve:   %.3f us\n", stats.max_solve_ns / 1e3);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+
+static void usage(void)
+{
+    fprintf(stderr, 
+        "usage: iksolver_cli -s SKELETON -e EFFECTOR [-i TARGETS] [-o POSES] [-b] [-B] [-n COUNT]\n"
+        "       iksolver_cli -r LOG\n");
+}
+
+
+
+int main(int argc, char **argv)
+{
+    const char *skeleton_path = NULL, *input_path = NULL, *output_path = NULL, *replay_path = NULL;
+    int effected = -1, binary_in = 0, binary_out = 0, block = 4096;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if(!strcmp(arg, "-b"))
+            binary_in = 1;
+        else if(!strcmp(arg, "-B"))
+            binary_out = 1;
+        else if(value && !strcmp(arg, "-s"))
+            skeleton_path = argv[++i];
+        else if(value && !strcmp(arg, "-e"))
+            effected = atoi(argv[++i]);
+        else if(value && !strcmp(arg, "-i"))
+            input_path = argv[++i];
+        else if(value && !strcmp(arg, "-o"))
+            output_path = argv[++i];
+        else if(value && !strcmp(arg, "-n"))
+            block = atoi(argv[++i]);
+        else if(value && !strcmp(arg, "-r"))
+            replay_path = argv[++i];
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    ik_init();
+
+    if(replay_path)
+        return replay(replay_path);
+
+    if(!skeleton_path || effected < 0 || block <= 0)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    cli_skeleton skel;
+    if(load_skeleton(skeleton_path, &skel) != IK_OK)
+        return EXIT_FAILURE;
+
+    int n = skel.skeleton->n_joints;
+    if(effected >= n)
+    {
+        fprintf(stderr, "iksolver_cli: effector %d out of range\n", effected);
+        return EXIT_FAILURE;
+    }
+
+    FILE *input = input_path ? fopen(input_path, binary_in ? "rb" : "r") : stdin;
+    FILE *output = output_path ? fopen(output_path, binary_out ? "wb" : "w") : stdout;
+    if(!input || !output)
+    {
+        fprintf(stderr, "iksolver_cli: cannot open '%s'\n", !input ? input_path : output_path);
+        return EXIT_FAILURE;
+    }
+
+    /* Large blocks keep per-call overhead of stdio and solver low */
+    setvbuf(input, NULL, _IOFBF, IO_BUFFER_SIZE);
+    setvbuf(output, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+    if((size_t)block > SIZE_MAX / sizeof(ik_vec2) / n)
+    {
+        fprintf(stderr, "iksolver_cli: block of %d targets too large\n", block);
+        return EXIT_FAILURE;
+    }
+
+    ik_vec2 *targets = malloc(sizeof(ik_vec2) * block);
+    ik_vec2 *poses = malloc(sizeof(ik_vec2) * block * n);
+    if(!targets || !poses)
+    {
+        fprintf(stderr, "iksolver_cli: out of memory for block of %d targets\n", block);
+        return EXIT_FAILURE;
+    }
+
+    int n_targets;
+
+    while((n_targets = read_targets(input, binary_in, targets, block)) > 0)
+    {
+        ik_skeleton_solve_trajectory(skel.skeleton, skel.pose, skel.order[effected],
+                                     targets, n_targets, poses);
+        write_poses(output, binary_out, &skel, poses, n_targets);
+    }
+
+    /* Buffered output is only written by the flush, so check after it */
+    int failed = fflush(output) != 0;
+    failed |= ferror(input) || ferror(output);
+
+    if(input != stdin)
+        fclose(input);
+    if(output != stdout)
+        failed |= fclose(output) != 0;
+
+    int status = failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    if(failed)
+        fprintf(stderr, "iksolver_cli: error reading targets or writing poses\n");
+
+    free(targets);
+    free(poses);
+    free(skel.order);
+    free(skel.pose);
+    ik_delete_skeleton(skel.skeleton);
+    ik_free_scratch();
+    return status;
+}